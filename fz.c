@@ -6,9 +6,41 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#endif
 
 #include "fz.h"
 
+/*
+    동작 통계 (fz_set_stats)
+    - 꺼져 있으면 시각을 재지 않고, 카운터는 계산 범위마다 지역변수로 센 것을 버린다.
+    - 켜져 있으면 계산 범위(조각)마다 한번씩 원자적으로 더한다.
+*/
+static int g_stats_on = 0;
+
+void fz_set_stats(int on)
+{
+    g_stats_on = on;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#define LIST_STATS(list)  (g_stats_on ? &(list)->stats : NULL)
+
 
 
 /*
@@ -28,56 +60,105 @@
     직전 T 값은 최대값만 선택되어 왔으므로 항상 최대 값을 보장함
 */
 
-/* 퍼지점수를 위해 설정된 보너스 값 */
-static int g_score_match       = 16;
-static int g_bonus_boundary    = 8;
-static int g_bonus_no_alnum    = 8;
-static int g_bonus_camel       = 5;
-static int g_bonus_continuous  = 4;
-static int g_penalty_ingap     = -1;
-static int g_penalty_firstgap  = -3;
+/* 퍼지점수를 위해 설정된 보너스 기본값 (fz_scorer_init) */
+#define FZ_SCORE_MATCH       (16)
+#define FZ_BONUS_BOUNDARY    (8)
+#define FZ_BONUS_NO_ALNUM    (8)
+#define FZ_BONUS_CAMEL       (5)
+#define FZ_BONUS_CONTINUOUS  (4)
+#define FZ_PENALTY_INGAP     (-1)
+#define FZ_PENALTY_FIRSTGAP  (-3)
 
+/* 문자별 보너스 종류, fz_scorer_t 의 가중치로 바꿔서 사용 */
+#define FZ_CLASS_NONE        (0)
+#define FZ_CLASS_BOUNDARY    (1)
+#define FZ_CLASS_NO_ALNUM    (2)
+#define FZ_CLASS_CAMEL       (3)
 
-int get_fuzzy_score(char* pat, char* txt, int* fscore, int position[])
-{
-    static int bonus [ MAX_PATH_LEN + 1];
-    static int matrix[ (MAX_PATH_LEN+1) * (MAX_PATTERN+1)];
-    static int cont  [ (MAX_PATH_LEN+1) * (MAX_PATTERN+1)];
-    int rowsize = strlen(pat) + 1;
-    int colsize = strlen(txt) + 1;
+#define BONUS_LUT(sc) \
+    { 0, (sc)->bonus_boundary, (sc)->bonus_no_alnum, (sc)->bonus_camel }
 
-#define IDX(r,c) (((r) * colsize) + (c))
 
-    memset(bonus, 0x00, sizeof(int) * colsize);
-    memset(matrix, 0x00, sizeof(int) * rowsize * colsize);
-    memset(cont  , 0x00, sizeof(int) * rowsize * colsize);
+/*
+    파일명별 소문자, 보너스 종류 (shadow)
+
+    - 파일명 문자마다 소문자와 보너스 종류를 한번만 구해서 파일명 바로 뒤에 같이 저장
+      [파일명\0][소문자 len 바이트][보너스 종류 len 바이트]
+    - 퍼지점수 계산은 tolower, isalnum 등을 다시 부르지 않고 이것만 읽는다.
+    - 가중치는 스코어러마다 다를 수 있으므로 보너스 값 대신 종류를 저장
+*/
+#define FZ_SHADOW_SIZE(len)  ((len) * 3 + 1)
+
+/*
+    파일명 인덱스 i 의 파일명 위치
+    _offs 의 최상위 비트가 있으면 mmap 한 캐시 POOL (또는 목록 파일), 없으면 _pool 에서의 위치
+*/
+#define FZ_OFF_MAPPED        (0x80000000u)
+#define ENT_NAME(list, i) \
+    ( ((list)->_offs[i] & FZ_OFF_MAPPED ? (list)->_map_pool : (list)->_pool) \
+      + ((list)->_offs[i] & ~FZ_OFF_MAPPED) )
+#define ENT_LOWER(name, len) ((name) + (len) + 1)
+#define ENT_BONUS(name, len) ((unsigned char*) (name) + (len) * 2 + 1)
+
+/*
+    목록 파일(fz_map_list_file)의 줄
+    - mmap 한 파일을 그대로 가리키므로 파일명 뒤에 shadow 가 없고 '\n' 으로 끝난다.
+    - 점수 계산시 shadow 를 스택에 구해서 쓰고, 정렬은 길이만큼만 비교한다.
+    - '\0' 은 이름을 구할 때(fz_get_name) 처음 한번 쓴다. (MAP_PRIVATE 라 파일은 바뀌지 않음)
+*/
+#define FZ_ENTRY_LINE        (4)
 
-    /* 보너스 계산 */
+static void make_shadow(char* txt, int len, char* lower, unsigned char* bonus)
+{
     char t_cur, t_pre = 0;
-    for(int col = 1; col < colsize; col++)
+    for(int i = 0; i < len; i++)
     {
-        t_cur = txt[col-1];
+        t_cur = txt[i];
         if(isalnum(t_pre) == 0 && isalnum(t_cur))
-            bonus[col] = g_bonus_boundary;
+            bonus[i] = FZ_CLASS_BOUNDARY;
         else if(isalnum(t_cur) == 0)
-            bonus[col] = g_bonus_no_alnum;
+            bonus[i] = FZ_CLASS_NO_ALNUM;
         else if(islower(t_pre) && isupper(t_cur))
-            bonus[col] = g_bonus_camel;
+            bonus[i] = FZ_CLASS_CAMEL;
+        else
+            bonus[i] = FZ_CLASS_NONE;
+        lower[i] = tolower(t_cur);
         t_pre = t_cur;
     }
-    char p_cur;
+}
+
+
+/*
+    실제 퍼지점수 계산부
+    가중치는 sc, matrix/cont 버퍼를 호출자가 넘겨준다. (스레드별로 버퍼를 따로 쓰기 위함)
+    txt 대신 make_shadow 로 구한 소문자/보너스 종류를 받는다.
+*/
+static int fuzzy_score_core(fz_scorer_t* sc, int* matrix, int* cont, char* pat,
+                            char* lower, unsigned char* bonus, int len,
+                            int* fscore, int position[])
+{
+    const int lut[4] = BONUS_LUT(sc);
+    int rowsize = strlen(pat) + 1;
+    int colsize = len + 1;
+
+#define IDX(r,c) (((r) * colsize) + (c))
+
+    memset(matrix, 0x00, sizeof(int) * rowsize * colsize);
+    memset(cont  , 0x00, sizeof(int) * rowsize * colsize);
+
+    char t_cur, p_cur;
     int first_col = 1;
     int max_score = 0; int max_col = 0;
 
     for(int row=1; row < rowsize; row++)
     {
-        p_cur = pat[row - 1];
+        p_cur = tolower(pat[row - 1]);
         int is_gap = 0;
         int is_first = 0;
 
         for(int col = first_col; col < colsize; col++)
         {
-            t_cur = txt[col-1];
+            t_cur = lower[col-1];
             
             int is_select = 0; /* false */
             int diag_score = matrix[IDX(row-1, col-1)];
@@ -86,11 +167,11 @@ int get_fuzzy_score(char* pat, char* txt, int* fscore, int position[])
             int cont_cnt = 0;            
             /* 왼쪽 점수 결정 */
             if(is_gap)
-                left_score += g_penalty_ingap;
+                left_score += sc->penalty_ingap;
             else
-                left_score += g_penalty_firstgap; /* 첫 연속 실패시 패널티가 크다. */
+                left_score += sc->penalty_firstgap; /* 첫 연속 실패시 패널티가 크다. */
             /* match */
-            if(tolower(p_cur) == tolower(t_cur))
+            if(p_cur == t_cur)
             {
                 /* 첫번째 시작 col 기록 */
                 if(is_first == 0)
@@ -101,16 +182,16 @@ int get_fuzzy_score(char* pat, char* txt, int* fscore, int position[])
                 /* 연속 개수 선정 */
                 cont_cnt = cont[IDX(row-1, col-1)] + 1;
                 /* 대각선 */
-                diag_score += g_score_match;
+                diag_score += sc->score_match;
                 /* 보너스 결정 */
-                bonus_score = bonus[col];
+                bonus_score = lut[bonus[col-1]];
                 if(cont_cnt > 1)
                 {
                     /* 연속이면 현재보너스, 연속보너스점수, 연속시작문자보너스 중 최대값을 선정해서 정함 */
-                    if(bonus_score < g_bonus_continuous)
-                        bonus_score = g_bonus_continuous;
-                    if(bonus_score < bonus[col - cont_cnt + 1])
-                        bonus_score = bonus[col - cont_cnt + 1];
+                    if(bonus_score < sc->bonus_continuous)
+                        bonus_score = sc->bonus_continuous;
+                    if(bonus_score < lut[bonus[col - cont_cnt]])
+                        bonus_score = lut[bonus[col - cont_cnt]];
                     bonus_score += 1;
                 }
                 /* 대각선이 더 큰경우 패턴 선택 */
@@ -147,9 +228,10 @@ int get_fuzzy_score(char* pat, char* txt, int* fscore, int position[])
     /* 최대값 */
     *fscore = max_score;
     /* 역추적 */
+    /* 가중치에 따라 최대값이 0 이면 (max_col 0) 첫 열을 넘어가지 않도록 */
     int back_row = rowsize - 1;
     int back_col = max_col;
-    while(back_row >= 1)
+    while(back_row >= 1 && back_col >= 1)
     {
         if(matrix[IDX(back_row, back_col-1)] <= matrix[IDX(back_row, back_col)])
         {
@@ -164,462 +246,4118 @@ int get_fuzzy_score(char* pat, char* txt, int* fscore, int position[])
 }
 
 
-/* list 객체의 메모리를 사용해서 처리 */
-int get_fuzzy_score_in_list( fscore_list_t* list, char* pat, char* txt, int* fscore, int position[])
+/*
+    점수만 구하는 퍼지점수 계산 (후보 선정용)
+
+    - fuzzy_score_core 와 같은 점수, 역추적을 하지 않으므로 전체 행렬 대신 한 행만 유지 (O(파일명 길이))
+    - 한 행을 제자리에서 갱신하고, 다음 칸의 대각선 값은 덮어쓰기 전에 보관
+    - 행마다 first_col 이전 칸은 계산하지 않고 다음 행에서도 읽지 않으므로 초기화(memset)하지 않는다.
+      (다음 행은 이번 행의 첫 일치 다음 칸부터 계산)
+    - 선택되지 않은 칸의 연속 개수는 0
+*/
+static int fuzzy_score_only(fz_scorer_t* sc, int* row_score, int* row_cont, char* pat,
+                            char* lower, unsigned char* bonus, int len, int* fscore)
 {
-    //static int bonus [ MAX_PATH_LEN + 1];
-    //static int matrix[ (MAX_PATH_LEN+1) * (MAX_PATTERN+1)];
-    //static int cont  [ (MAX_PATH_LEN+1) * (MAX_PATTERN+1)];
+    const int lut[4] = BONUS_LUT(sc);
     int rowsize = strlen(pat) + 1;
-    int colsize = strlen(txt) + 1;
-
-#define IDX(r,c) (((r) * colsize) + (c))
-
-    memset(list->_bonus, 0x00, sizeof(int) * colsize);
-    memset(list->_matrix, 0x00, sizeof(int) * rowsize * colsize);
-    memset(list->_cont  , 0x00, sizeof(int) * rowsize * colsize);
-
-    /* 보너스 계산 */
-    char t_cur, t_pre = 0;
-    for(int col = 1; col < colsize; col++)
-    {
-        t_cur = txt[col-1];
-        if(isalnum(t_pre) == 0 && isalnum(t_cur))
-            list->_bonus[col] = g_bonus_boundary;
-        else if(isalnum(t_cur) == 0)
-            list->_bonus[col] = g_bonus_no_alnum;
-        else if(islower(t_pre) && isupper(t_cur))
-            list->_bonus[col] = g_bonus_camel;
-        t_pre = t_cur;
-    }
-    char p_cur;
+    int colsize = len + 1;
     int first_col = 1;
-    int max_score = 0; int max_col = 0;
+    int max_score = 0;
 
     for(int row=1; row < rowsize; row++)
     {
-        p_cur = pat[row - 1];
+        char p_cur = tolower(pat[row - 1]);
         int is_gap = 0;
         int is_first = 0;
+        int left = 0;       /* T(r, c-1), first_col 이전은 0 */
+        int diag = 0;       /* T(r-1, c-1) */
+        int diag_cont = 0;
+        if(row > 1)
+        {
+            diag = row_score[first_col - 1];
+            diag_cont = row_cont[first_col - 1];
+        }
 
         for(int col = first_col; col < colsize; col++)
         {
-            t_cur = txt[col-1];
-            
-            int is_select = 0; /* false */
-            int diag_score = list->_matrix[IDX(row-1, col-1)];
-            int left_score = list->_matrix[IDX(row  , col-1)];
+            /* 첫 행의 윗 행은 모두 0 */
+            int up = row > 1 ? row_score[col] : 0;
+            int up_cont = row > 1 ? row_cont[col] : 0;
+            int score;
+            int cont_cnt = 0;
+            int left_score = left + (is_gap ? sc->penalty_ingap : sc->penalty_firstgap);
+            int is_select = 0;
+            int diag_score = 0;
             int bonus_score = 0;
-            int cont_cnt = 0;            
-            /* 왼쪽 점수 결정 */
-            if(is_gap)
-                left_score += g_penalty_ingap;
-            else
-                left_score += g_penalty_firstgap; /* 첫 연속 실패시 패널티가 크다. */
-            /* match */
-            if(tolower(p_cur) == tolower(t_cur))
+
+            if(p_cur == lower[col-1])
             {
-                /* 첫번째 시작 col 기록 */
                 if(is_first == 0)
                 {
                     is_first = 1;
                     first_col = col+1;
                 }
-                /* 연속 개수 선정 */
-                cont_cnt = list->_cont[IDX(row-1, col-1)] + 1;
-                /* 대각선 */
-                diag_score += g_score_match;
-                /* 보너스 결정 */
-                bonus_score = list->_bonus[col];
+                cont_cnt = diag_cont + 1;
+                diag_score = diag + sc->score_match;
+                bonus_score = lut[bonus[col-1]];
                 if(cont_cnt > 1)
                 {
-                    /* 연속이면 현재보너스, 연속보너스점수, 연속시작문자보너스 중 최대값을 선정해서 정함 */
-                    if(bonus_score < g_bonus_continuous)
-                        bonus_score = g_bonus_continuous;
-                    if(bonus_score < list->_bonus[col - cont_cnt + 1])
-                        bonus_score = list->_bonus[col - cont_cnt + 1];
+                    if(bonus_score < sc->bonus_continuous)
+                        bonus_score = sc->bonus_continuous;
+                    if(bonus_score < lut[bonus[col - cont_cnt]])
+                        bonus_score = lut[bonus[col - cont_cnt]];
                     bonus_score += 1;
                 }
-                /* 대각선이 더 큰경우 패턴 선택 */
                 if(left_score < diag_score + bonus_score)
-                    is_select = 1; /* true */
+                    is_select = 1;
             }
-            /* 선택되면 대각선, 안될경우 왼쪽 선택한다. */
             if(is_select)
             {
-                is_gap = 0; /* false */
-                list->_matrix[IDX(row, col)] = diag_score + bonus_score;
-                list->_cont  [IDX(row, col)] = cont_cnt;
+                is_gap = 0;
+                score = diag_score + bonus_score;
             }
             else
             {
-                is_gap = 1; /* true */
-                list->_matrix[IDX(row  , col)] = left_score ;
-            }
-            /* 음수값 처리 */
-            if(list->_matrix[IDX(row  , col)] < 0)
-                list->_matrix[IDX(row  , col)] = 0;
-            /* 최대값 구하기 */
-            if(row == rowsize-1 && max_score < list->_matrix[IDX(row  , col)])
-            {
-                max_score = list->_matrix[IDX(row  , col)];
-                max_col = col;
+                is_gap = 1;
+                score = left_score;
+                cont_cnt = 0;
             }
+            if(score < 0)
+                score = 0;
+            if(row == rowsize-1 && max_score < score)
+                max_score = score;
+
+            row_score[col] = score;
+            row_cont[col] = cont_cnt;
+            left = score;
+            diag = up;
+            diag_cont = up_cont;
         }
         /* 한글자도 매치되지 않은 경우 실패 */
         if(is_first == 0)
             return 0;
     }
 
-    /* 최대값 */
     *fscore = max_score;
-    /* 역추적 */
-    int back_row = rowsize - 1;
-    int back_col = max_col;
-    while(back_row >= 1)
+    return 1;
+}
+
+
+/*
+    여러 파일명을 동시에 계산하는 퍼지점수 (SIMD, 점수만)
+
+    - 레인 하나에 파일명 하나, FZ_LANES 개를 16비트 점수로 같이 계산 (파일명마다 열을 나란히 배치)
+    - 패턴 한 글자(행)씩 모든 레인을 열 방향으로 진행, 분기 대신 마스크로 선택
+    - fuzzy_score_only 와 같은 점수 (최대 점수가 16비트를 넘지 않음)
+      . 레인별 first_col 이전 칸은 마스크로 0 처리, 다음 행은 그 칸을 읽지 않는다.
+      . 연속 시작문자 보너스(bonus[col - cont_cnt + 1])는 레인마다 위치가 다르므로
+        대각선을 따라 연속 시작 보너스를 같이 넘겨준다.
+      . 파일명 길이를 넘는 칸은 0 문자라 일치하지 않고 점수가 줄기만 하므로 최대값에 영향 없음
+    - gcc 벡터 확장으로 작성하고 AVX2 대상으로 컴파일, 실행시 CPU 를 보고 선택
+      지원하지 않으면 fuzzy_score_only 사용
+      (SSE4.2 대상은 16 레인 벡터를 원소별로 풀어서 fuzzy_score_only 보다 느림, fz_bench -M)
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FZ_SIMD
+#endif
+
+#ifdef FZ_SIMD
+#define FZ_LANES  (16)
+
+typedef int16_t fz_vec_t __attribute__((vector_size(FZ_LANES * sizeof(int16_t))));
+
+typedef struct fz_lanes_st
+{
+    fz_vec_t txt  [MAX_PATH_LEN + 1];   /* 열별 소문자, 레인마다 파일명 하나 */
+    fz_vec_t bonus[MAX_PATH_LEN + 1];
+    fz_vec_t score[MAX_PATH_LEN + 1];   /* 한 행 */
+    fz_vec_t cont [MAX_PATH_LEN + 1];
+    fz_vec_t start[MAX_PATH_LEN + 1];   /* 연속 시작문자 보너스 */
+} fz_lanes_t;
+
+#define V_SEL(m, a, b)  (((a) & (m)) | ((b) & ~(m)))
+#define V_MAX(a, b)     V_SEL((a) > (b), (a), (b))
+
+/* 파일명 인덱스 ents[0, n) 를 레인에 배치, 가장 긴 파일명 길이 반환 */
+static int fill_lanes(fz_scorer_t* sc, fz_lanes_t* ln, fscore_list_t* list, uint32_t* ents, int n)
+{
+    const int lut[4] = BONUS_LUT(sc);
+    int maxlen = 0;
+    for(int k=0; k < n; k++)
+        if(maxlen < list->_lens[ents[k]])
+            maxlen = list->_lens[ents[k]];
+
+    for(int k=0; k < FZ_LANES; k++)
     {
-        if(list->_matrix[IDX(back_row, back_col-1)] <= list->_matrix[IDX(back_row, back_col)])
+        int len = k < n ? list->_lens[ents[k]] : 0;
+        if(len > 0)
         {
-            back_row--; 
-            position[back_col - 1] = 1;
+            char* name = ENT_NAME(list, ents[k]);
+            char* lower = ENT_LOWER(name, len);
+            unsigned char* bonus = ENT_BONUS(name, len);
+            char shadow[ FZ_SHADOW_SIZE(MAX_PATH_LEN) ];
+            if(list->_flags[ents[k]] & FZ_ENTRY_LINE)
+            {
+                lower = shadow;
+                bonus = (unsigned char*) shadow + len;
+                make_shadow(name, len, lower, bonus);
+            }
+            for(int col = 1; col <= len; col++)
+            {
+                ln->txt[col][k] = lower[col-1];
+                ln->bonus[col][k] = lut[bonus[col-1]];
+            }
+        }
+        for(int col = len + 1; col <= maxlen; col++)
+        {
+            ln->txt[col][k] = 0;
+            ln->bonus[col][k] = 0;
         }
-        back_col --;
     }
+    return maxlen;
+}
 
-#undef IDX
-    return 1;
+/* 레인별 점수를 out 에 기록, 일치하지 않으면 -1 */
+static inline __attribute__((always_inline))
+void score_lanes_body(fz_scorer_t* sc, fz_lanes_t* ln, char* pat, int maxlen, int* out)
+{
+    const fz_vec_t zero = {0};
+    const fz_vec_t match_score = zero + (int16_t) sc->score_match;
+    const fz_vec_t bonus_cont  = zero + (int16_t) sc->bonus_continuous;
+    const fz_vec_t pen_ingap   = zero + (int16_t) sc->penalty_ingap;
+    const fz_vec_t pen_first   = zero + (int16_t) sc->penalty_firstgap;
+    int rowsize = strlen(pat) + 1;
+
+    for(int col = 0; col <= maxlen; col++)
+    {
+        ln->score[col] = zero;
+        ln->cont[col] = zero;
+        ln->start[col] = zero;
+    }
+
+    fz_vec_t first_col = zero + 1;
+    fz_vec_t max_score = zero;
+    fz_vec_t alive = zero - 1;   /* 모든 행에서 한 글자 이상 일치 */
+
+    for(int row=1; row < rowsize; row++)
+    {
+        fz_vec_t p_cur = zero + (int16_t) (char) tolower(pat[row - 1]);
+        fz_vec_t is_gap = zero;
+        fz_vec_t is_first = zero;
+        fz_vec_t left = zero;
+        fz_vec_t diag = zero;
+        fz_vec_t diag_cont = zero;
+        fz_vec_t diag_start = zero;
+        fz_vec_t next_first = first_col;
+        fz_vec_t colv = zero;
+        int last = (row == rowsize - 1);
+
+        for(int col = 1; col <= maxlen; col++)
+        {
+            fz_vec_t up = ln->score[col];
+            fz_vec_t up_cont = ln->cont[col];
+            fz_vec_t up_start = ln->start[col];
+            colv += 1;
+
+            fz_vec_t active = ~(first_col > colv);
+            fz_vec_t match = (ln->txt[col] == p_cur) & active;
+            fz_vec_t bonus = ln->bonus[col];
+            fz_vec_t cont_cnt = diag_cont + 1;
+            fz_vec_t run = cont_cnt > 1;
+            fz_vec_t start = V_SEL(run, diag_start, bonus);
+            fz_vec_t run_bonus = V_MAX(V_MAX(bonus, bonus_cont), start) + 1;
+            fz_vec_t diag_score = diag + match_score + V_SEL(run, run_bonus, bonus);
+            fz_vec_t left_score = left + V_SEL(is_gap, pen_ingap, pen_first);
+            fz_vec_t select = match & (diag_score > left_score);
+            fz_vec_t score = V_SEL(select, diag_score, left_score);
+            score = V_MAX(score, zero) & active;
+
+            ln->score[col] = score;
+            ln->cont[col] = cont_cnt & select;
+            ln->start[col] = start & select;
+            is_gap = active & ~select;
+            next_first = V_SEL(match & ~is_first, colv + 1, next_first);
+            is_first |= match;
+            if(last)
+                max_score = V_MAX(max_score, score);
+
+            left = score;
+            diag = up;
+            diag_cont = up_cont;
+            diag_start = up_start;
+        }
+        alive &= is_first;
+        first_col = next_first;
+
+        int any = 0;
+        for(int k=0; k < FZ_LANES; k++)
+            any |= alive[k];
+        if(!any)
+            break;
+    }
+
+    for(int k=0; k < FZ_LANES; k++)
+        out[k] = alive[k] ? max_score[k] : -1;
 }
 
+__attribute__((target("avx2")))
+static void score_lanes_avx2(fz_scorer_t* sc, fz_lanes_t* ln, char* pat, int maxlen, int* out)
+{
+    score_lanes_body(sc, ln, pat, maxlen, out);
+}
 
+/* 사용할 SIMD 계산, 없으면 NULL */
+typedef void (*fz_lanes_fn)(fz_scorer_t* sc, fz_lanes_t* ln, char* pat, int maxlen, int* out);
 
-/* 역순정렬 비교함수 */
-static int comp_cand(const void* a, const void* b)
+static fz_lanes_fn get_lanes_fn(fz_scorer_t* sc)
 {
-    fscore_t* aa = *((fscore_t**)a);
-    fscore_t* bb = *((fscore_t**)b);
+    /* 가중치가 커서 16비트를 넘을 수 있으면 사용하지 않음 */
+    int bonus = sc->bonus_boundary;
+    if(bonus < sc->bonus_no_alnum)
+        bonus = sc->bonus_no_alnum;
+    if(bonus < sc->bonus_camel)
+        bonus = sc->bonus_camel;
+    if(bonus < sc->bonus_continuous)
+        bonus = sc->bonus_continuous;
+    if(sc->score_match < 0 || sc->bonus_boundary < 0 || sc->bonus_no_alnum < 0 ||
+       sc->bonus_camel < 0 || sc->bonus_continuous < 0 ||
+       (sc->score_match + bonus + 1) * MAX_PATTERN > 16384 ||
+       sc->penalty_ingap < -16384 || sc->penalty_firstgap < -16384 ||
+       sc->penalty_ingap > 0 || sc->penalty_firstgap > 0)
+        return NULL;
 
-    if(aa->score > bb->score)
-        return -1;
-    if(aa->score < bb->score)
-        return 1;
+    if(__builtin_cpu_supports("avx2"))
+        return score_lanes_avx2;
+    return NULL;
+}
 
-    int alen = strlen(aa->fname);
-    int blen = strlen(bb->fname);
+#define FZ_LANES_SIZE  (sizeof(fz_lanes_t))
 
-    if(alen < blen)
-        return -1;
-    if(alen > blen)
-        return 1;
+static fz_lanes_t* alloc_lanes(void)
+{
+    void* ptr = NULL;
+    if(posix_memalign(&ptr, sizeof(fz_vec_t), sizeof(fz_lanes_t)) != 0)
+        return NULL;
+    return (fz_lanes_t*) ptr;
+}
+#else
+typedef struct fz_lanes_st fz_lanes_t;
 
-    if(strcmp(aa->fname, bb->fname) > 0)
-        return -1;
-    if(strcmp(aa->fname, bb->fname) < 0)
-        return 1;
-    return 0;
+#define FZ_LANES_SIZE  (0)
+
+static fz_lanes_t* alloc_lanes(void)
+{
+    return NULL;
 }
+#endif
 
 
-void init_list (fscore_list_t* list)
+/* 가중치만 기본값으로 (버퍼 없음) */
+static void init_weights(fz_scorer_t* sc)
 {
-    list->_fname_pool = (char*) malloc ( MAX_FILE_NUM * MAX_PATH_LEN );
-    list->_fname_cursor = list->_fname_pool;
-    list->cands = (fscore_t**) malloc ( sizeof(fscore_t*) * MAX_FILE_NUM);
-    list->scores = (fscore_t*) malloc ( sizeof(fscore_t)  * MAX_FILE_NUM);
-    list->len = 0;
-    list->cands_cnt = 0;
-    list->_bonus = (int*) malloc (sizeof(int) * (MAX_PATH_LEN + 1));
-    list->_matrix =(int*) malloc (sizeof(int) * ((MAX_PATH_LEN+1) * (MAX_PATTERN+1)));
-    list->_cont =  (int*) malloc (sizeof(int) * ((MAX_PATH_LEN+1) * (MAX_PATTERN+1)));
-
-    list->_alloc_size = 
-         (MAX_FILE_NUM * MAX_PATH_LEN) 
-        +(sizeof(fscore_t*) * MAX_FILE_NUM)
-        +(sizeof(fscore_t)  * MAX_FILE_NUM)
-        +(sizeof(int) * (MAX_PATH_LEN + 1))
-        +(sizeof(int) * ((MAX_PATH_LEN+1) * (MAX_PATTERN+1)))
-        +(sizeof(int) * ((MAX_PATH_LEN+1) * (MAX_PATTERN+1)))
-    ;
+    memset(sc, 0x00, sizeof(fz_scorer_t));
+    sc->score_match      = FZ_SCORE_MATCH;
+    sc->bonus_boundary   = FZ_BONUS_BOUNDARY;
+    sc->bonus_no_alnum   = FZ_BONUS_NO_ALNUM;
+    sc->bonus_camel      = FZ_BONUS_CAMEL;
+    sc->bonus_continuous = FZ_BONUS_CONTINUOUS;
+    sc->penalty_ingap    = FZ_PENALTY_INGAP;
+    sc->penalty_firstgap = FZ_PENALTY_FIRSTGAP;
 }
 
-void add_list(fscore_list_t* list, char* item)
+int fz_scorer_init(fz_scorer_t* sc)
 {
-    if(list->len >= MAX_FILE_NUM)
+    init_weights(sc);
+    sc->_shadow = (char*) malloc (FZ_SHADOW_SIZE(MAX_PATH_LEN));
+    sc->_matrix = (int*) malloc (sizeof(int) * ((MAX_PATH_LEN+1) * (MAX_PATTERN+1)));
+    sc->_cont   = (int*) malloc (sizeof(int) * ((MAX_PATH_LEN+1) * (MAX_PATTERN+1)));
+    sc->_lanes  = alloc_lanes();
+    if(sc->_shadow == NULL || sc->_matrix == NULL || sc->_cont == NULL)
     {
-        exit(1);
+        fz_scorer_free(sc);
+        return 0;
     }
-    strcpy(list->_fname_cursor, item);
-    list->scores[list->len].fname = list->_fname_cursor;
-    list->scores[list->len].score = MAX_FILE_NUM - list->len;
-    list->scores[list->len]._match = MAX_PATTERN;
-    list->_fname_cursor += strlen(item) + 1;
-    /* 후보도 바로 갱신 */
-    list->cands[list->cands_cnt++] = &(list->scores[list->len]);
-    list->len++;
+    return 1;
 }
 
-void clear_list (fscore_list_t* list)
+void fz_scorer_free(fz_scorer_t* sc)
 {
-    if( list->_fname_pool != NULL)
-        free(list->_fname_pool);
-    if( list->scores != NULL )
-        free(list->scores);
-    if( list->cands != NULL )
-        free(list->cands);
-    if( list->_bonus != NULL )
-        free(list->_bonus);
-    if( list->_matrix != NULL )
-        free(list->_matrix );
-    if( list->_cont != NULL )
-        free(list->_cont);
-    
-    list->_fname_pool = NULL;
-    list->_fname_cursor = NULL;
-    list->len = 0;
-    list->cands_cnt = 0;    
-    list->_alloc_size = 0;
+    free(sc->_shadow);
+    free(sc->_matrix);
+    free(sc->_cont);
+    free(sc->_lanes);
+    free(sc->_cands);
+    free(sc->_scores);
+    sc->_shadow = NULL;
+    sc->_matrix = NULL;
+    sc->_cont = NULL;
+    sc->_lanes = NULL;
+    sc->_cands = NULL;
+    sc->_scores = NULL;
+    sc->_cap = 0;
 }
 
+/* 스코어러 버퍼 크기 (사용량 계산용) */
+#define FZ_SCORER_SIZE(sc) \
+    ( FZ_SHADOW_SIZE(MAX_PATH_LEN) + sizeof(int) * ((MAX_PATH_LEN+1) * (MAX_PATTERN+1)) * 2 \
+      + ((sc)->_lanes ? FZ_LANES_SIZE : 0) )
 
 /*
-    파일리스트 및 퍼지점수 구하기
+    MAX_PATH_LEN 보다 긴 txt (stdin 필터, 목록 파일의 긴 줄) 는 길이만큼 버퍼를 따로 잡아서 전체를 계산
+    (줄은 65535 바이트 이하라 행렬도 (MAX_PATTERN+1) * 65536 칸 이하)
+    메모리가 부족하면 -1 (호출자가 앞부분만 계산)
+*/
+static int score_long(fz_scorer_t* sc, char* pat, char* txt, int len, int* fscore, int position[])
+{
+    size_t cells = (strlen(pat) + 1) * ((size_t) len + 1);
+    char* shadow = (char*) malloc (FZ_SHADOW_SIZE((size_t) len));
+    int* matrix = (int*) malloc (sizeof(int) * cells);
+    int* cont = (int*) malloc (sizeof(int) * cells);
+    int ret = -1;
 
-    - 재귀호출 디렉토리 순회하면서 파일명 추출
-    - 파일명 자체는 메모리 풀에 '\0' 으로 구분되도록 기록
-    - fscore structure 는 파일명의 포인터
-    - _match는 직전 최대 매치된 길이 기록 (백스페이스로 패턴이 하나 줄었을때 빠르게 찾기위함)
+    if(shadow != NULL && matrix != NULL && cont != NULL)
+    {
+        make_shadow(txt, len, shadow, (unsigned char*) shadow + len);
+        ret = fuzzy_score_core(sc, matrix, cont, pat,
+                               shadow, (unsigned char*) shadow + len, len, fscore, position);
+    }
+    free(shadow);
+    free(matrix);
+    free(cont);
+    return ret;
+}
 
-*/
+int fz_score(fz_scorer_t* sc, char* pat, char* txt, int* fscore, int position[])
+{
+    /* fz_scorer_init 이 실패한 스코어러 */
+    if(sc->_shadow == NULL)
+        return 0;
+
+    int len = strlen(txt);
+    if(len > MAX_PATH_LEN)
+    {
+        int ret = score_long(sc, pat, txt, len, fscore, position);
+        if(ret >= 0)
+            return ret;
+        len = MAX_PATH_LEN;
+    }
+    make_shadow(txt, len, sc->_shadow, (unsigned char*) sc->_shadow + len);
+    return fuzzy_score_core(sc, sc->_matrix, sc->_cont, pat,
+                            sc->_shadow, (unsigned char*) sc->_shadow + len, len, fscore, position);
+}
 
 
-static void update_files(int prefix_len, char* path, fscore_list_t* list)
+int get_fuzzy_score(char* pat, char* txt, int* fscore, int position[])
 {
-    /* 파일리스트 갱신 */
-    add_list(list, &path[prefix_len+1]);
+    static char shadow[ FZ_SHADOW_SIZE(MAX_PATH_LEN) ];
+    static int matrix[ (MAX_PATH_LEN+1) * (MAX_PATTERN+1)];
+    static int cont  [ (MAX_PATH_LEN+1) * (MAX_PATTERN+1)];
+    static fz_scorer_t sc;
+
+    /* 기본 가중치, 버퍼는 정적 버퍼 사용 */
+    init_weights(&sc);
+    sc._shadow = shadow;
+    sc._matrix = matrix;
+    sc._cont = cont;
+    return fz_score(&sc, pat, txt, fscore, position);
 }
 
-/* 재귀호출 파일리스트 추출 */
-static void get_file_list_recur (int prefix_len, const char* base_path, int isfile, fscore_list_t* list)
+
+/* list 객체의 스코어러를 사용해서 처리 (화면에 그릴 파일명만 호출되므로 shadow 는 다시 구한다.) */
+int get_fuzzy_score_in_list( fscore_list_t* list, char* pat, char* txt, int* fscore, int position[])
 {
-    DIR *dir;  
-    struct dirent *ent;
-    char path [ MAX_PATH_LEN ];
-    struct stat sb;
+    return fz_score(&list->_scorer, pat, txt, fscore, position);
+}
 
-    dir = opendir(base_path);
-    if( dir == NULL )
-        return;
 
-    while( (ent = readdir(dir)) )
+
+/*
+    문자 집합 시그니처
+    - 대소문자 구분없이 문자마다 64비트 중 하나의 비트를 대응 (a-z: 0~25, 0-9: 26~35, 그외: 36~63)
+    - 패턴의 시그니처 비트가 파일명 시그니처에 모두 있지 않으면 절대 일치할 수 없으므로
+      퍼지점수 계산 없이 바로 실패처리 한다.
+*/
+static uint64_t get_char_sig(char* txt, int len)
+{
+    uint64_t sig = 0;
+    for(int i=0; i < len; i++)
     {
-        strcpy(path, base_path);
-        strcat(path, "/");
-        strcat(path, ent->d_name);
-        
-#ifdef _DIRENT_HAVE_D_TYPE
-        /* Posix 표준이 아니다. GNU에서 제공 */
-        if(ent->d_type == DT_DIR)
-        {
-#else
-        /* 디렉토리 여부를 별도로 확인 overhead */
-        stat( path, &sb);        
-        if( S_ISDIR(sb.st_mode) )
-        {
-#endif
-            if(strcmp(ent->d_name, "..") == 0 ||
-               strcmp(ent->d_name, ".")  == 0 )
-                   continue;
-            get_file_list_recur(prefix_len, path, isfile, list);
-            if(isfile == 0)
-                update_files(prefix_len, path, list);
-        }
+        unsigned char c = (unsigned char) tolower(txt[i]);
+        if(c >= 'a' && c <= 'z')
+            sig |= (uint64_t)1 << (c - 'a');
+        else if(c >= '0' && c <= '9')
+            sig |= (uint64_t)1 << (26 + c - '0');
         else
-        {
-            if(isfile)
-                update_files(prefix_len, path, list);
-        }
+            sig |= (uint64_t)1 << (36 + c % 28);
     }
+    return sig;
 }
 
 
+/*
+    정렬 키
+    점수 내림차순, 길이 오름차순, 파일명 역순 으로 정렬하기 위해
+    하나의 64비트 정수로 만들어 큰 값이 앞에 오도록 한다.
 
-void load_file_list( fscore_list_t* list, char* path, int isfile )
+    [63..32] 점수 (부호비트 반전)
+    [31..16] 0xFFFF - 길이
+    [15.. 0] 파일명 앞 2바이트
+
+    키가 같을때만 strcmp 로 비교한다.
+*/
+static uint32_t get_len_key(char* txt, int len)
 {
-    init_list(list);
+    if(len > 0xFFFF)
+        len = 0xFFFF;
+    return ((uint32_t)(0xFFFF - len) << 16)
+         | (len > 0 ? (uint32_t)(unsigned char)txt[0] << 8 : 0)
+         | (len > 1 ? (uint32_t)(unsigned char)txt[1] : 0);
+}
 
-    int prefix_len = strlen(path);
-    get_file_list_recur( prefix_len , path, isfile, list);
+#define SORT_KEY(list, i) \
+    ( ((uint64_t)((uint32_t)(list)->scores[i] ^ 0x80000000u) << 32) | (list)->_lkeys[i] )
 
-    /* 후보정렬 */
-    qsort( list->cands, list->cands_cnt, sizeof(fscore_t*), comp_cand);
+
+/* 키가 같을 때 역순정렬 비교 */
+static int comp_name(char* aname, uint32_t a, char* bname, uint32_t b, int len)
+{
+    /* 정렬 키에 길이가 있어서 키가 같으면 길이도 같다. (목록 파일의 줄은 '\0' 으로 끝나지 않음) */
+    int cmp = memcmp(aname, bname, len);
+    if(cmp > 0)
+        return -1;
+    if(cmp < 0)
+        return 1;
+    /* 같은 이름이면 먼저 추가된 것이 앞 */
+    if(a < b)
+        return -1;
+    if(a > b)
+        return 1;
+    return 0;
+}
+
+/* 역순정렬 비교함수 (파일명 인덱스) */
+static int comp_cand(fscore_list_t* list, uint32_t a, uint32_t b)
+{
+    uint64_t akey = SORT_KEY(list, a);
+    uint64_t bkey = SORT_KEY(list, b);
+
+    if(akey > bkey)
+        return -1;
+    if(akey < bkey)
+        return 1;
+    return comp_name(ENT_NAME(list, a), a, ENT_NAME(list, b), b, list->_lens[a]);
+}
+
+
+/*
+    전체정렬
+    - 후보마다 정렬 키와 파일명 위치를 sort_item_t 로 모아서 정렬 (qsort 비교함수가 list 없이 동작)
+    - 기수정렬 (LSD, 8비트씩)
+      . 정렬 키가 내림차순이 되도록 키를 반전해서 오름차순 정렬
+      . 모든 후보의 자릿값이 같은 바이트는 건너뜀 (점수 상위바이트 등)
+      . 키가 같은 구간만 comp_item 으로 다시 정렬
+    - 후보가 적으면 qsort
+    메모리가 부족하면 0 을 반환하고 호출자가 힙 정렬을 사용
+*/
+typedef struct sort_item_st
+{
+    uint64_t key;    /* 반전한 정렬 키 */
+    char* name;
+    uint32_t idx;
+} sort_item_t;
+
+#define RADIX_SORT_MIN (65536)
+
+static int comp_item(const void* a, const void* b)
+{
+    sort_item_t* aa = (sort_item_t*) a;
+    sort_item_t* bb = (sort_item_t*) b;
+
+    if(aa->key < bb->key)
+        return -1;
+    if(aa->key > bb->key)
+        return 1;
+    /* 반전하기 전 키의 하위 32비트가 get_len_key */
+    return comp_name(aa->name, aa->idx, bb->name, bb->idx, 0xFFFF - ((uint32_t) ~aa->key >> 16));
+}
+
+/*
+    items[0, cnt) 정렬, 정렬된 배열 반환 (기수정렬이면 temp 쪽일 수 있다)
+    temp 가 NULL 이거나 후보가 적으면 qsort
+*/
+static sort_item_t* sort_items(sort_item_t* items, sort_item_t* temp, int cnt)
+{
+    if(temp == NULL || cnt < RADIX_SORT_MIN)
+    {
+        qsort( items, cnt, sizeof(sort_item_t), comp_item);
+        return items;
+    }
+
+    uint64_t key_or = 0, key_and = ~(uint64_t)0;
+    for(int i=0; i < cnt; i++)
+    {
+        key_or  |= items[i].key;
+        key_and &= items[i].key;
+    }
+
+    for(int shift=0; shift < 64; shift += 8)
+    {
+        /* 모두 같은 자릿값이면 건너뜀 */
+        if((((key_or ^ key_and) >> shift) & 0xFF) == 0)
+            continue;
+
+        int count[256] = {0};
+        for(int i=0; i < cnt; i++)
+            count[(items[i].key >> shift) & 0xFF]++;
+        int sum = 0;
+        for(int d=0; d < 256; d++)
+        {
+            int c = count[d];
+            count[d] = sum;
+            sum += c;
+        }
+        for(int i=0; i < cnt; i++)
+            temp[count[(items[i].key >> shift) & 0xFF]++] = items[i];
+
+        sort_item_t* swap = items;
+        items = temp;
+        temp = swap;
+    }
+
+    /* 키가 같은 구간 */
+    for(int i=0; i < cnt; )
+    {
+        int j = i + 1;
+        while(j < cnt && items[j].key == items[i].key)
+            j++;
+        if(j - i > 1)
+            qsort( &items[i], j - i, sizeof(sort_item_t), comp_item);
+        i = j;
+    }
+    return items;
 }
 
+static int sort_cands(fscore_list_t* list, uint32_t* cands, int cnt)
+{
+    sort_item_t* items = (sort_item_t*) malloc (sizeof(sort_item_t) * cnt);
+    sort_item_t* temp  = cnt < RADIX_SORT_MIN ? NULL : (sort_item_t*) malloc (sizeof(sort_item_t) * cnt);
+    if(items == NULL || (temp == NULL && cnt >= RADIX_SORT_MIN))
+    {
+        free(items);
+        free(temp);
+        return 0;
+    }
+
+    for(int i=0; i < cnt; i++)
+    {
+        items[i].key = ~SORT_KEY(list, cands[i]);
+        items[i].name = ENT_NAME(list, cands[i]);
+        items[i].idx = cands[i];
+    }
+
+    sort_item_t* sorted = sort_items(items, temp, cnt);
+    for(int i=0; i < cnt; i++)
+        cands[i] = sorted[i].idx;
+
+    free(items);
+    free(temp);
+    return 1;
+}
+
+
+/*
+    Top-K 부분정렬
+
+    - 화면에 보이는 후보만 순서가 필요하므로 전체 정렬 대신 힙에서 필요한 만큼만 꺼낸다.
+    - cands[0, _ordered) 는 정렬완료, 나머지 cands[_ordered, cands_cnt) 는 힙
+    - 힙은 배열 끝에서부터 거꾸로 둔다. (힙 j번째 == cands[cands_cnt-1-j])
+      이렇게 하면 힙의 마지막 칸이 항상 cands[_ordered] 이므로
+      루트와 마지막 칸을 바꾸는 것만으로 꺼낸 값이 정렬된 앞부분 뒤에 붙는다.
+*/
+static void heap_sift_down(fscore_list_t* list, uint32_t* top, int n, int j)
+{
+    uint32_t ent = top[-j];
+    for(;;)
+    {
+        int child = j * 2 + 1;
+        if(child >= n)
+            break;
+        if(child + 1 < n && comp_cand(list, top[-(child+1)], top[-child]) < 0)
+            child++;
+        if(comp_cand(list, top[-child], ent) >= 0)
+            break;
+        top[-j] = top[-child];
+        j = child;
+    }
+    top[-j] = ent;
+}
+
+static void heap_build(fscore_list_t* list)
+{
+    int n = list->cands_cnt - list->_ordered;
+    uint32_t* top = &(list->cands[list->cands_cnt - 1]);
+
+    for(int j = n / 2 - 1; j >= 0; j--)
+        heap_sift_down(list, top, n, j);
+    list->_heaped = 1;
+}
+
+static int order_candidates(fscore_list_t* list, int cnt)
+{
+    if(cnt > list->cands_cnt)
+        cnt = list->cands_cnt;
+    if(list->_ordered >= cnt)
+        return list->_ordered;
+
+    /* 아직 하나도 정렬되지 않았고 전부 필요하면 그냥 전체정렬이 빠르다. */
+    if(list->_ordered == 0 && cnt == list->cands_cnt &&
+       sort_cands( list, list->cands, list->cands_cnt ))
+    {
+        list->_ordered = list->cands_cnt;
+        return list->_ordered;
+    }
+
+    if(!list->_heaped)
+        heap_build(list);
+
+    uint32_t* top = &(list->cands[list->cands_cnt - 1]);
+    while(list->_ordered < cnt)
+    {
+        int n = list->cands_cnt - list->_ordered;
+        uint32_t best = top[0];
+        top[0] = top[-(n-1)];
+        top[-(n-1)] = best;  /* == cands[_ordered] */
+        list->_ordered++;
+        heap_sift_down(list, top, n - 1, 0);
+    }
+    return list->_ordered;
+}
+
+int fz_order_candidates(fscore_list_t* list, int cnt)
+{
+    if(!g_stats_on)
+        return order_candidates(list, cnt);
+
+    uint64_t t0 = now_ns();
+    int ret = order_candidates(list, cnt);
+    uint64_t ns = now_ns() - t0;
+    list->stats.sort_ns += ns;
+    list->stats.last_sort_ns += ns;
+    return ret;
+}
+
+/* 후보 갱신 후 cands_topk 개(0이면 전부)만 정렬 */
+static void order_new_candidates(fscore_list_t* list)
+{
+    list->_ordered = 0;
+    list->_heaped = 0;
+    if(list->cands_topk > 0)
+        fz_order_candidates(list, list->cands_topk);
+    else
+        fz_order_candidates(list, list->cands_cnt);
+}
+
+
+/*
+    파일명 POOL (arena)
+    - 한 덩어리로 할당해서 이어 쓰고, 모자라면 두배로 늘린다. (realloc 으로 옮겨질 수 있다)
+    - 파일명은 포인터 대신 32비트 위치(_offs)로 가리키므로 옮겨져도 그대로 유효
+      (최상위 비트는 캐시 POOL 표시용이라 최대 2GB)
+*/
+#define FZ_ARENA_CHUNK   (1024 * 1024)
+#define FZ_LIST_INIT_CAP (1024)
+
+/* 파일명별 배열 크기 (후보 포함) */
+#define FZ_ENTRY_SIZE \
+    (sizeof(int) + sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint8_t) \
+     + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint32_t))
+
+static int arena_alloc(fscore_list_t* list, size_t size, uint32_t* off)
+{
+    if(list->_pool_used + size >= FZ_OFF_MAPPED)
+        return 0;
+    if(list->_pool_cap - list->_pool_used < size)
+    {
+        size_t cap = list->_pool_cap ? list->_pool_cap * 2 : FZ_ARENA_CHUNK;
+        while(cap - list->_pool_used < size)
+            cap *= 2;
+        if(cap > FZ_OFF_MAPPED)
+            cap = FZ_OFF_MAPPED;
+        char* pool = (char*) realloc (list->_pool, cap);
+        if(pool == NULL)
+            return 0;
+        list->_pool = pool;
+        list->_pool_cap = cap;
+    }
+    *off = (uint32_t) list->_pool_used;
+    list->_pool_used += size;
+    return 1;
+}
+
+/*
+    파일명별 배열/cands 확장
+    인덱스로 가리키므로 옮겨져도 고칠 것이 없다.
+*/
+static int grow_list(fscore_list_t* list)
+{
+    int cap = list->_cap ? list->_cap * 2 : FZ_LIST_INIT_CAP;
+
+    /* 일부만 늘어나도 크기만 크므로 문제없다. (_cap 은 모두 성공했을 때만 갱신) */
+    int*      scores = (int*)      realloc (list->scores, sizeof(int)      * cap);
+    if(scores)
+        list->scores = scores;
+    uint32_t* offs   = (uint32_t*) realloc (list->_offs,  sizeof(uint32_t) * cap);
+    if(offs)
+        list->_offs = offs;
+    uint16_t* lens   = (uint16_t*) realloc (list->_lens,  sizeof(uint16_t) * cap);
+    if(lens)
+        list->_lens = lens;
+    uint8_t*  flags  = (uint8_t*)  realloc (list->_flags, sizeof(uint8_t)  * cap);
+    if(flags)
+        list->_flags = flags;
+    uint32_t* lkeys  = (uint32_t*) realloc (list->_lkeys, sizeof(uint32_t) * cap);
+    if(lkeys)
+        list->_lkeys = lkeys;
+    uint64_t* sigs   = (uint64_t*) realloc (list->_sigs,  sizeof(uint64_t) * cap);
+    if(sigs)
+        list->_sigs = sigs;
+    uint32_t* cands  = (uint32_t*) realloc (list->cands,  sizeof(uint32_t) * cap);
+    if(cands)
+        list->cands = cands;
+
+    if(!scores || !offs || !lens || !flags || !lkeys || !sigs || !cands)
+        return 0;
+    list->_cap = cap;
+    return 1;
+}
+
+int init_list (fscore_list_t* list)
+{
+    list->_pool = NULL;
+    list->_pool_used = 0;
+    list->_pool_cap = 0;
+    list->_map_pool = NULL;
+    list->_map_size = 0;
+    list->scores = NULL;
+    list->_offs = NULL;
+    list->_lens = NULL;
+    list->_flags = NULL;
+    list->_lkeys = NULL;
+    list->_sigs = NULL;
+    list->cands = NULL;
+    list->_cap = 0;
+    list->_walker = NULL;
+    list->_dead = 0;
+    list->_cache = NULL;
+    list->_watch = NULL;
+    list->len = 0;
+    list->cands_cnt = 0;
+    list->cands_topk = 0;
+    list->_ordered = 0;
+    list->_heaped = 0;
+    memset(list->_levels, 0x00, sizeof(list->_levels));
+    list->_level_cnt = 0;
+    list->_level_pat[0] = '\0';
+    list->_pos = NULL;
+    list->_pos_gen = 1;
+    list->_cancel = NULL;
+    list->_cancel_arg = NULL;
+    memset(&list->stats, 0x00, sizeof(list->stats));
+
+    /* 실패해도 나머지 필드는 초기화된 상태라 clear_list 할 수 있다. */
+    int ok = fz_scorer_init(&list->_scorer);
+
+    /* 실제 사용량, add_list 에서 늘어난다. */
+    list->_alloc_size = ok ? FZ_SCORER_SIZE(&list->_scorer) : 0;
+    return ok;
+}
+
+/* 파일명 인덱스 len 에 추가 (배열 크기는 호출전에 확보) */
+static void append_entry(fscore_list_t* list, uint32_t off, int len, uint64_t sig, uint32_t lkey)
+{
+    int idx = list->len;
+
+    list->_offs[idx] = off;
+    list->scores[idx] = -idx; /* 추가된 순서대로 */
+    list->_flags[idx] = 0;
+    list->_sigs[idx] = sig;
+    list->_lens[idx] = len;
+    list->_lkeys[idx] = lkey;
+    /* 후보도 바로 갱신 */
+    list->cands[list->cands_cnt++] = idx;
+    list->_heaped = 0;
+    list->len++;
+}
+
+int add_list(fscore_list_t* list, char* item)
+{
+    int len = strlen(item);
+    uint32_t off;
+
+    if(len > 0xFFFF)
+        return 0;
+    if(list->len >= list->_cap && !grow_list(list))
+        return 0;
+    if(!arena_alloc(list, FZ_SHADOW_SIZE(len), &off))
+        return 0;
+
+    char* fname = list->_pool + off;
+    memcpy(fname, item, len + 1);
+    make_shadow(fname, len, ENT_LOWER(fname, len), ENT_BONUS(fname, len));
+
+    append_entry(list, off, len, get_char_sig(item, len), get_len_key(item, len));
+
+    list->_alloc_size += FZ_SHADOW_SIZE(len) + FZ_ENTRY_SIZE;
+    return 1;
+}
+
+/*
+    목록 파일을 mmap 해서 줄마다 위치/길이만 기록 (파일명 복사 없음)
+    - MAP_PRIVATE + PROT_WRITE : 이름을 구할 때 줄 끝에 '\0' 을 쓰기 위함, 쓴 페이지만 복사되고 파일은 그대로
+    - 개행 없이 끝난 마지막 줄은 파일 끝 다음을 읽게 되므로 POOL 에 복사 (add_list)
+*/
+int fz_map_list_file(fscore_list_t* list, char* path)
+{
+    if(!init_list(list))
+        return 0;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return 0;
+
+    struct stat sb;
+    if(fstat(fd, &sb) != 0)
+    {
+        close(fd);
+        return 0;
+    }
+    /* 줄 위치는 31비트 */
+    if((uint64_t) sb.st_size >= FZ_OFF_MAPPED)
+    {
+        close(fd);
+        errno = EFBIG;
+        return 0;
+    }
+    if(sb.st_size == 0)
+    {
+        close(fd);
+        return 1;
+    }
+
+    size_t size = sb.st_size;
+    char* map = (char*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return 0;
+    list->_map_pool = map;
+    list->_map_size = size;
+
+    char* p = map;
+    char* end = map + size;
+    char* nl;
+    while( (nl = (char*) memchr(p, '\n', end - p)) != NULL )
+    {
+        size_t len = nl - p;
+        if(len > 0 && p[len - 1] == '\r')
+            len--;
+        if(len > 0 && len <= 0xFFFF)
+        {
+            if(list->len >= list->_cap && !grow_list(list))
+                goto nomem;
+            append_entry(list, (uint32_t) (p - map) | FZ_OFF_MAPPED, len,
+                         get_char_sig(p, len), get_len_key(p, len));
+            list->_flags[list->len - 1] = FZ_ENTRY_LINE;
+        }
+        p = nl + 1;
+    }
+    list->_alloc_size += FZ_ENTRY_SIZE * list->len;
+
+    if(p < end)
+    {
+        size_t len = end - p;
+        if(p[len - 1] == '\r')
+            len--;
+        if(len > 0 && len <= 0xFFFF)
+        {
+            char* last = (char*) malloc (len + 1);
+            if(last == NULL)
+                goto nomem;
+            memcpy(last, p, len);
+            last[len] = '\0';
+            int ok = add_list(list, last);
+            free(last);
+            if(!ok)
+                goto nomem;
+        }
+    }
+    return 1;
+
+nomem:
+    clear_list(list);
+    errno = ENOMEM;
+    return 0;
+}
+
+char* fz_get_name(fscore_list_t* list, uint32_t idx)
+{
+    char* name = ENT_NAME(list, idx);
+    /* 목록 파일의 줄은 처음 구할 때 줄 끝을 '\0' 으로 (해당 페이지만 복사된다) */
+    if((list->_flags[idx] & FZ_ENTRY_LINE) && name[list->_lens[idx]] != '\0')
+        name[list->_lens[idx]] = '\0';
+    return name;
+}
+
+char* fz_cand_name(fscore_list_t* list, int i)
+{
+    return fz_get_name(list, list->cands[i]);
+}
+
+int fz_cand_score(fscore_list_t* list, int i)
+{
+    return list->scores[list->cands[i]];
+}
+
+/*
+    후보 일치위치 캐시
+    - 화면에 보이는 후보만 필요하므로 작은 직접 대응 캐시 (후보 위치 i -> i % FZ_POS_CACHE)
+    - 칸은 파일명 인덱스와 세대(_pos_gen)로 확인, 정렬/후보가 바뀌어도 같은 파일명이면 그대로 사용
+    - 역추적은 패턴 글자마다 최대 하나씩 표시하므로 MAX_PATTERN 개면 충분
+*/
+#define FZ_POS_CACHE (256)
+
+typedef struct fz_pos_st
+{
+    uint32_t ent;
+    uint32_t gen;   /* 0 이면 빈 칸 */
+    uint16_t cnt;
+    uint16_t pos[MAX_PATTERN];
+} fz_pos_t;
+
+int fz_cand_positions(fscore_list_t* list, int i, uint16_t** pos)
+{
+    if(list->_level_pat[0] == '\0')
+        return 0;
+    if(list->_pos == NULL)
+    {
+        list->_pos = (fz_pos_t*) calloc (FZ_POS_CACHE, sizeof(fz_pos_t));
+        if(list->_pos == NULL)
+            return 0;
+    }
+
+    uint32_t ent = list->cands[i];
+    fz_pos_t* slot = &(list->_pos[i % FZ_POS_CACHE]);
+    if(slot->gen != list->_pos_gen || slot->ent != ent)
+    {
+        int buf[MAX_PATH_LEN];
+        int score = 0;
+        char* name = fz_get_name(list, ent);
+        int len = list->_lens[ent];
+        /* 긴 줄은 줄 길이만큼 따로 잡는다. (줄은 65535 바이트 이하) */
+        int* position = len > MAX_PATH_LEN ? (int*) calloc (len, sizeof(int)) : buf;
+
+        if(position == buf)
+            memset(position, 0x00, sizeof(int) * len);
+        slot->cnt = 0;
+        if(position != NULL && fz_score(&list->_scorer, list->_level_pat, name, &score, position))
+        {
+            for(int j=0; j < len && slot->cnt < MAX_PATTERN; j++)
+            {
+                if(position[j])
+                    slot->pos[slot->cnt++] = j;
+            }
+        }
+        if(position != buf)
+            free(position);
+        slot->ent = ent;
+        slot->gen = list->_pos_gen;
+    }
+    *pos = slot->pos;
+    return slot->cnt;
+}
+
+/* 패턴, 가중치가 바뀌어 캐시한 일치위치를 버린다. */
+static void reset_positions(fscore_list_t* list)
+{
+    list->_pos_gen++;
+    if(list->_pos_gen == 0)
+    {
+        list->_pos_gen = 1;
+        if(list->_pos != NULL)
+            memset(list->_pos, 0x00, sizeof(fz_pos_t) * FZ_POS_CACHE);
+    }
+}
+
+/* 점진 검색용 후보 스택 해제 */
+static void free_levels(fscore_list_t* list)
+{
+    for(int i=0; i <= MAX_PATTERN; i++)
+    {
+        if(list->_levels[i].cands != NULL)
+            free(list->_levels[i].cands);
+        if(list->_levels[i].scores != NULL)
+            free(list->_levels[i].scores);
+    }
+    memset(list->_levels, 0x00, sizeof(list->_levels));
+    list->_level_cnt = 0;
+    list->_level_pat[0] = '\0';
+}
+
+static void stop_loading( fscore_list_t* list );
+static void stop_watch( fscore_list_t* list );
+static void free_cache( fscore_list_t* list );
+
+void clear_list (fscore_list_t* list)
+{
+    stop_loading(list);
+    stop_watch(list);
+    free_cache(list);
+
+    if( list->_map_size > 0 )
+        munmap(list->_map_pool, list->_map_size);
+    if( list->_pool != NULL )
+        free(list->_pool);
+    if( list->scores != NULL )
+        free(list->scores);
+    free(list->_offs);
+    free(list->_lens);
+    free(list->_flags);
+    free(list->_lkeys);
+    free(list->_sigs);
+    if( list->cands != NULL )
+        free(list->cands);
+    fz_scorer_free(&list->_scorer);
+    free_levels(list);
+    free(list->_pos);
+    list->_pos = NULL;
+    
+    list->_pool = NULL;
+    list->_pool_used = 0;
+    list->_pool_cap = 0;
+    list->_map_pool = NULL;
+    list->_map_size = 0;
+    list->scores = NULL;
+    list->_offs = NULL;
+    list->_lens = NULL;
+    list->_flags = NULL;
+    list->_lkeys = NULL;
+    list->_sigs = NULL;
+    list->cands = NULL;
+    list->_cap = 0;
+    list->len = 0;
+    list->_dead = 0;
+    list->cands_cnt = 0;    
+    list->_alloc_size = 0;
+}
+
+
+/*
+    경로 → 값 해시 테이블 (open addressing)
+    - 디렉토리 mtime 테이블, 재검증할 디렉토리 집합, 삭제 예정 경로 집합에 사용
+    - key 는 복사해서 보관, 삭제는 드물어서 테이블을 다시 만든다.
+*/
+typedef struct fz_hent_st
+{
+    char*    key;     /* NULL 이면 빈칸 */
+    int      len;
+    uint32_t hash;
+    int64_t  val;
+} fz_hent_t;
+
+typedef struct fz_hash_st
+{
+    fz_hent_t* ents;
+    int  cap;   /* 2의 거듭제곱 */
+    int  cnt;
+} fz_hash_t;
+
+static uint32_t hash_str(char* s, int len)
+{
+    uint32_t h = 2166136261u;   /* FNV-1a */
+    for(int i=0; i < len; i++)
+        h = (h ^ (unsigned char) s[i]) * 16777619u;
+    return h;
+}
+
+static fz_hent_t* hash_find(fz_hash_t* h, char* key, int len)
+{
+    if(h->cnt == 0)
+        return NULL;
+    uint32_t hv = hash_str(key, len);
+    for(int i = hv & (h->cap - 1); h->ents[i].key != NULL; i = (i + 1) & (h->cap - 1))
+    {
+        fz_hent_t* e = &(h->ents[i]);
+        if(e->hash == hv && e->len == len && memcmp(e->key, key, len) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+/* 없으면 추가 (val 은 0), 메모리 부족이면 NULL */
+static fz_hent_t* hash_put(fz_hash_t* h, char* key, int len)
+{
+    fz_hent_t* e = hash_find(h, key, len);
+    if(e != NULL)
+        return e;
+
+    if((h->cnt + 1) * 2 > h->cap)
+    {
+        int cap = h->cap ? h->cap * 2 : 64;
+        fz_hent_t* ents = (fz_hent_t*) calloc (cap, sizeof(fz_hent_t));
+        if(ents == NULL)
+            return NULL;
+        for(int i=0; i < h->cap; i++)
+        {
+            if(h->ents[i].key == NULL)
+                continue;
+            int j = h->ents[i].hash & (cap - 1);
+            while(ents[j].key != NULL)
+                j = (j + 1) & (cap - 1);
+            ents[j] = h->ents[i];
+        }
+        free(h->ents);
+        h->ents = ents;
+        h->cap = cap;
+    }
+
+    char* k = (char*) malloc (len + 1);
+    if(k == NULL)
+        return NULL;
+    memcpy(k, key, len);
+    k[len] = '\0';
+
+    uint32_t hv = hash_str(key, len);
+    int i = hv & (h->cap - 1);
+    while(h->ents[i].key != NULL)
+        i = (i + 1) & (h->cap - 1);
+    e = &(h->ents[i]);
+    e->key = k;
+    e->len = len;
+    e->hash = hv;
+    e->val = 0;
+    h->cnt++;
+    return e;
+}
+
+static void hash_free(fz_hash_t* h)
+{
+    for(int i=0; i < h->cap; i++)
+        free(h->ents[i].key);
+    free(h->ents);
+    h->ents = NULL;
+    h->cap = 0;
+    h->cnt = 0;
+}
+
+/* path 가 dir 자신이거나 dir 아래 경로인지 ("" 은 전체) */
+static int is_under(char* path, int len, char* dir, int dirlen)
+{
+    if(dirlen == 0)
+        return 1;
+    if(len < dirlen || memcmp(path, dir, dirlen) != 0)
+        return 0;
+    return len == dirlen || path[dirlen] == '/';
+}
+
+/* path 가 trees 의 디렉토리 중 하나이거나 그 아래 경로인지 */
+static int in_trees(fz_hash_t* trees, char* path, int len)
+{
+    if(trees->cnt == 0)
+        return 0;
+    if(hash_find(trees, "", 0) != NULL)
+        return 1;
+    for(int i=1; i <= len; i++)
+    {
+        if((i == len || path[i] == '/') && hash_find(trees, path, i) != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+    i 번째 칸을 비우고 뒤에 이어진 칸들을 당겨서 탐색이 끊기지 않게 한다. (linear probing 삭제)
+    당겨진 칸은 i 이후로만 옮겨지므로 앞에서부터 훑는 중이면 i 를 다시 보면 된다.
+*/
+static void hash_remove_at(fz_hash_t* h, int i)
+{
+    int mask = h->cap - 1;
+    free(h->ents[i].key);
+    h->ents[i].key = NULL;
+    h->cnt--;
+    for(int j = (i + 1) & mask; h->ents[j].key != NULL; j = (j + 1) & mask)
+    {
+        int k = h->ents[j].hash & mask;
+        /* k 가 (i, j] 안이면 제자리 근처라 옮기지 않는다. */
+        if(i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        h->ents[i] = h->ents[j];
+        h->ents[j].key = NULL;
+        i = j;
+    }
+}
+
+/* trees 의 디렉토리와 그 아래 경로를 모두 삭제, 한번 훑으면서 제자리에서 지운다. (메모리 할당 없음) */
+static void hash_remove_trees(fz_hash_t* h, fz_hash_t* trees)
+{
+    if(trees->cnt == 0)
+        return;
+    for(int i=0; i < h->cap && h->cnt > 0; )
+    {
+        fz_hent_t* e = &(h->ents[i]);
+        if(e->key != NULL && in_trees(trees, e->key, e->len))
+            hash_remove_at(h, i);
+        else
+            i++;
+    }
+}
+
+
+/*
+    파일리스트 및 퍼지점수 구하기
+
+    - 디렉토리 하나가 작업 단위, 스레드별 deque 에 넣고 꺼내면서 병렬로 순회
+      . 자기 deque 는 뒤에서(LIFO) 꺼내고, 비어 있으면 다른 스레드 deque 앞에서(FIFO) 훔쳐온다.
+    - 하위 디렉토리는 부모 디렉토리 fd 기준으로 openat (fd 가 모자라면 base 기준 경로로 open)
+    - 리눅스는 getdents64 로 큰 버퍼 단위로 읽고, 그 외는 fdopendir/readdir
+    - 찾은 파일명은 스레드별 batch 버퍼에 '\0' 으로 구분해서 쌓아 두었다가
+      순회가 끝나면 한 스레드에서 list 에 추가 (list 는 순회 중에 건드리지 않음)
+    - 파일명 자체는 메모리 풀에 '\0' 으로 구분되도록 기록
+    - fscore structure 는 파일명의 포인터
+    - 패턴이 바뀔때 다시 계산할 후보는 update_candidates_by_fuzzy_score 의 후보 스택으로 관리
+
+*/
+#ifndef DT_UNKNOWN
+#define DT_UNKNOWN  (0)
+#define DT_DIR      (4)
+#define DT_REG      (8)
+#endif
+
+#define FZ_BATCH_SIZE  (256 * 1024)
+#define FZ_DENTS_SIZE  (64 * 1024)
+
+/*
+    순회 결과 레코드, [종류 1byte][(FZ_REC_DIR 만) mtime 8byte][경로\0]
+    - 같은 batch 안의 레코드는 순서대로 적용해야 한다. (삭제 후 다시 추가 등)
+*/
+#define FZ_REC_ENTRY        (1)  /* 파일명 추가 */
+#define FZ_REC_DIR          (2)  /* 디렉토리 mtime (캐시용) */
+#define FZ_REC_DEL_CHILDREN (3)  /* 디렉토리 바로 아래 파일명 삭제 (다시 읽기 전) */
+#define FZ_REC_DEL_TREE     (4)  /* 디렉토리 아래 파일명 모두 삭제 (디렉토리가 없어짐) */
+#define FZ_REC_DEL_ENTRY    (5)  /* 파일명 하나 삭제 (감시 모드) */
+
+/* 순회 결과 버퍼 */
+typedef struct fz_batch_st
+{
+    struct fz_batch_st* next;
+    int  used;
+    int  cnt;     /* 레코드 개수 */
+    int  found;   /* FZ_REC_ENTRY 개수 */
+    char buf[FZ_BATCH_SIZE];
+} fz_batch_t;
+
+/* 열린 디렉토리 fd, 하위 디렉토리를 모두 열 때까지 유지 */
+typedef struct fz_dirref_st
+{
+    int fd;
+    int refs;
+} fz_dirref_t;
+
+/* 작업 단위 (디렉토리) */
+typedef struct fz_walk_item_st
+{
+    fz_dirref_t* parent;  /* NULL 이면 base */
+    int  pathlen;         /* base 기준 상대경로 길이 */
+    int  namepos;         /* 경로중 디렉토리 이름 시작 위치 */
+    int  check;           /* 1 이면 mtime 이 바뀌었을 때만 다시 읽기 (캐시 재검증) */
+    int64_t mtime;        /* check 일때 캐시에 기록된 mtime */
+    char path[1];
+} fz_walk_item_t;
+
+typedef struct fz_deque_st
+{
+    pthread_mutex_t lock;
+    fz_walk_item_t** items;
+    int  cap;
+    int  head;   /* 훔쳐가는 쪽 */
+    int  tail;   /* 자기 쪽 */
+} fz_deque_t;
+
+typedef struct fz_walker_st
+{
+    int  base_fd;
+    int  isfile;
+    int  nthreads;
+    fz_deque_t* deques;
+
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int  pending;  /* 큐에 있거나 처리중인 디렉토리 수 */
+    int  queued;   /* 큐에 있는 디렉토리 수 */
+    int  idle;     /* 일감을 기다리는 스레드 수 */
+    int  abort;    /* 중단 요청 */
+
+    /* 다 채운 batch, 순회한 순서대로 (FIFO) */
+    fz_batch_t* done_head;
+    fz_batch_t* done_tail;
+
+    /* 백그라운드 순회 */
+    struct fz_walk_thread_st* threads;
+    pthread_t master;
+    int  stream;    /* 1 이면 FZ_FLUSH_MS 마다 batch 를 넘긴다. */
+    int  finished;  /* 순회 완료 (lock 으로 보호) */
+    int  found;     /* 찾은 파일 수 */
+    int  drained;   /* 그 중 list 에 반영한 수 (list 스레드에서만 사용) */
+
+    /* 캐시 */
+    int  want_dirs;   /* 디렉토리 mtime 레코드 기록 */
+    fz_hash_t known;  /* 캐시에 있는 디렉토리, 재검증에서 다시 순회하지 않음 (읽기 전용) */
+    int64_t start_ns; /* 순회 시작 시각 */
+    uint64_t walk_ns; /* 순회에 걸린 시간 (run_walker) */
+
+    /* 감시 모드, 순회하는 디렉토리를 읽기 전에 감시 등록 */
+    struct fz_watch_st* watch;
+} fz_walker_t;
+
+typedef struct fz_walk_thread_st
+{
+    fz_walker_t* walker;
+    int  id;
+    pthread_t tid;
+    fz_batch_t* batch;
+    char* dents;
+    long long flushed_ms;  /* 마지막으로 batch 를 넘긴 시각 */
+    uint64_t dirs;         /* 읽은 디렉토리 수 (통계) */
+    uint64_t files;        /* 만난 파일 수 (통계) */
+} fz_walk_thread_t;
+
+#define FZ_FLUSH_MS  (50)
+
+static void watch_dir(struct fz_watch_st* wt, char* path, int pathlen);
+
+/* 로드/감시 알림 (fz_set_notify) */
+static int g_notify_fd = -1;
+
+void fz_set_notify(int fd)
+{
+    g_notify_fd = fd;
+}
+
+static void notify_load(void)
+{
+    if(g_notify_fd >= 0)
+    {
+        ssize_t ret = write(g_notify_fd, "l", 1);
+        (void) ret;
+    }
+}
+
+static long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+static void release_dirref(fz_dirref_t* ref)
+{
+    if(ref != NULL && __sync_sub_and_fetch(&ref->refs, 1) == 0)
+    {
+        close(ref->fd);
+        free(ref);
+    }
+}
+
+static fz_walk_item_t* new_walk_item(fz_dirref_t* parent, char* dir, int dirlen, char* name, int namelen)
+{
+    fz_walk_item_t* item = (fz_walk_item_t*) malloc (sizeof(fz_walk_item_t) + dirlen + namelen + 1);
+    if(item == NULL)
+        return NULL;
+    if(dirlen > 0)
+    {
+        memcpy(item->path, dir, dirlen);
+        item->path[dirlen++] = '/';
+    }
+    memcpy(item->path + dirlen, name, namelen);
+    item->path[dirlen + namelen] = '\0';
+    item->pathlen = dirlen + namelen;
+    item->namepos = dirlen;
+    item->check = 0;
+    item->mtime = 0;
+    item->parent = parent;
+    if(parent != NULL)
+        __sync_fetch_and_add(&parent->refs, 1);
+    return item;
+}
+
+static void finish_walk_item(fz_walker_t* w, fz_walk_item_t* item)
+{
+    release_dirref(item->parent);
+    free(item);
+    if(__sync_sub_and_fetch(&w->pending, 1) == 0)
+    {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+static void push_walk_item(fz_walker_t* w, int id, fz_walk_item_t* item)
+{
+    fz_deque_t* dq = &(w->deques[id]);
+
+    __sync_fetch_and_add(&w->pending, 1);
+
+    pthread_mutex_lock(&dq->lock);
+    if(dq->tail - dq->head == dq->cap)
+    {
+        /* 링버퍼 확장 */
+        int cap = dq->cap ? dq->cap * 2 : 256;
+        fz_walk_item_t** items = (fz_walk_item_t**) malloc (sizeof(fz_walk_item_t*) * cap);
+        if(items == NULL)
+        {
+            pthread_mutex_unlock(&dq->lock);
+            finish_walk_item(w, item);
+            return;
+        }
+        for(int i = dq->head; i < dq->tail; i++)
+            items[i - dq->head] = dq->items[i % dq->cap];
+        free(dq->items);
+        dq->items = items;
+        dq->tail -= dq->head;
+        dq->head = 0;
+        dq->cap = cap;
+    }
+    dq->items[dq->tail++ % dq->cap] = item;
+    pthread_mutex_unlock(&dq->lock);
+
+    __sync_fetch_and_add(&w->queued, 1);
+    if(__sync_fetch_and_add(&w->idle, 0) > 0)
+    {
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+static fz_walk_item_t* take_walk_item(fz_walker_t* w, int id, int steal)
+{
+    fz_deque_t* dq = &(w->deques[id]);
+    fz_walk_item_t* item = NULL;
+
+    pthread_mutex_lock(&dq->lock);
+    if(dq->tail > dq->head)
+    {
+        if(steal)
+            item = dq->items[dq->head++ % dq->cap];
+        else
+            item = dq->items[--dq->tail % dq->cap];
+    }
+    pthread_mutex_unlock(&dq->lock);
+
+    if(item != NULL)
+        __sync_fetch_and_sub(&w->queued, 1);
+    return item;
+}
+
+/* 일감 가져오기, 모든 순회가 끝나면 NULL */
+static fz_walk_item_t* next_walk_item(fz_walker_t* w, int id)
+{
+    for(;;)
+    {
+        if(__sync_fetch_and_add(&w->abort, 0))
+            return NULL;
+
+        fz_walk_item_t* item = take_walk_item(w, id, 0);
+        for(int i=1; item == NULL && i < w->nthreads; i++)
+            item = take_walk_item(w, (id + i) % w->nthreads, 1);
+        if(item != NULL)
+            return item;
+
+        pthread_mutex_lock(&w->lock);
+        __sync_fetch_and_add(&w->idle, 1);
+        while(__sync_fetch_and_add(&w->queued, 0) == 0 &&
+              __sync_fetch_and_add(&w->pending, 0) > 0 && !__sync_fetch_and_add(&w->abort, 0))
+            pthread_cond_wait(&w->cond, &w->lock);
+        __sync_fetch_and_sub(&w->idle, 1);
+        int done = (__sync_fetch_and_add(&w->pending, 0) == 0 || __sync_fetch_and_add(&w->abort, 0));
+        pthread_mutex_unlock(&w->lock);
+        if(done)
+            return NULL;
+    }
+}
+
+static void flush_batch(fz_walk_thread_t* t)
+{
+    if(t->batch == NULL || t->batch->cnt == 0)
+        return;
+    __sync_fetch_and_add(&t->walker->found, t->batch->found);
+    pthread_mutex_lock(&t->walker->lock);
+    t->batch->next = NULL;
+    if(t->walker->done_tail != NULL)
+        t->walker->done_tail->next = t->batch;
+    else
+        t->walker->done_head = t->batch;
+    t->walker->done_tail = t->batch;
+    pthread_mutex_unlock(&t->walker->lock);
+    t->batch = NULL;
+    t->flushed_ms = now_ms();
+    notify_load();
+}
+
+/* 결과 레코드 기록 */
+static void emit_record(fz_walk_thread_t* t, int kind, int64_t mtime,
+                        char* dir, int dirlen, char* name, int namelen)
+{
+    int size = 1 + (kind == FZ_REC_DIR ? sizeof(int64_t) : 0) + dirlen + 1 + namelen + 1;
+
+    if(t->batch != NULL && FZ_BATCH_SIZE - t->batch->used < size)
+        flush_batch(t);
+    if(t->batch == NULL)
+    {
+        t->batch = (fz_batch_t*) malloc (sizeof(fz_batch_t));
+        if(t->batch == NULL)
+            return;
+        t->batch->next = NULL;
+        t->batch->used = 0;
+        t->batch->cnt = 0;
+        t->batch->found = 0;
+    }
+    char* p = t->batch->buf + t->batch->used;
+    *p++ = (char) kind;
+    if(kind == FZ_REC_DIR)
+    {
+        memcpy(p, &mtime, sizeof(int64_t));
+        p += sizeof(int64_t);
+    }
+    if(dirlen > 0)
+    {
+        memcpy(p, dir, dirlen);
+        p[dirlen++] = '/';
+    }
+    memcpy(p + dirlen, name, namelen);
+    p[dirlen + namelen] = '\0';
+    t->batch->used = p + dirlen + namelen + 1 - t->batch->buf;
+    t->batch->cnt++;
+    if(kind == FZ_REC_ENTRY)
+        t->batch->found++;
+}
+
+static void emit_name(fz_walk_thread_t* t, char* dir, int dirlen, char* name, int namelen)
+{
+    emit_record(t, FZ_REC_ENTRY, 0, dir, dirlen, name, namelen);
+}
+
+static int64_t stat_mtime(struct stat* sb)
+{
+#if defined(__APPLE__)
+    return (int64_t) sb->st_mtimespec.tv_sec * 1000000000 + sb->st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    return (int64_t) sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+#else
+    return (int64_t) sb->st_mtime * 1000000000;
+#endif
+}
+
+/* 디렉토리 항목 하나 처리 */
+static void walk_entry(fz_walk_thread_t* t, fz_walk_item_t* item, fz_dirref_t* ref,
+                       char* name, int type)
+{
+    fz_walker_t* w = t->walker;
+    int namelen = strlen(name);
+
+    if(strcmp(name, "..") == 0 || strcmp(name, ".")  == 0 )
+        return;
+    /* 퍼지점수 버퍼보다 긴 경로는 제외 */
+    if(item->pathlen + 1 + namelen >= MAX_PATH_LEN)
+        return;
+
+    if(type == DT_UNKNOWN)
+    {
+        /* 디렉토리 여부를 별도로 확인 overhead */
+        struct stat sb;
+        type = DT_REG;
+        if(fstatat(ref->fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(sb.st_mode))
+            type = DT_DIR;
+    }
+    if(type != DT_DIR)
+        t->files++;
+
+    if(type == DT_DIR)
+    {
+        /* 재검증중이면 캐시에 있는 디렉토리는 따로 확인하므로 새 디렉토리만 순회 */
+        int known = 0;
+        if(w->known.cnt > 0)
+        {
+            char path[MAX_PATH_LEN];
+            int len = 0;
+            if(item->pathlen > 0)
+            {
+                memcpy(path, item->path, item->pathlen);
+                path[item->pathlen] = '/';
+                len = item->pathlen + 1;
+            }
+            memcpy(path + len, name, namelen);
+            known = hash_find(&w->known, path, len + namelen) != NULL;
+        }
+        fz_walk_item_t* child = known ? NULL : new_walk_item(ref, item->path, item->pathlen, name, namelen);
+        if(child != NULL)
+            push_walk_item(w, t->id, child);
+        if(w->isfile == 0)
+            emit_name(t, item->path, item->pathlen, name, namelen);
+    }
+    else
+    {
+        if(w->isfile)
+            emit_name(t, item->path, item->pathlen, name, namelen);
+    }
+}
+
+#if defined(__linux__) && defined(SYS_getdents64)
+struct fz_dirent64
+{
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+#endif
+
+static void walk_dir(fz_walk_thread_t* t, fz_walk_item_t* item)
+{
+    fz_walker_t* w = t->walker;
+    int fd = -1;
+    struct stat sb;
+
+    if(item->check)
+    {
+        /* 캐시 재검증: mtime 이 같으면 바로 아래 항목은 그대로 */
+        if(w->watch != NULL)
+            watch_dir(w->watch, item->path, item->pathlen);
+        int ret = item->pathlen > 0 ? fstatat(w->base_fd, item->path, &sb, AT_SYMLINK_NOFOLLOW)
+                                    : fstat(w->base_fd, &sb);
+        if(ret != 0 || !S_ISDIR(sb.st_mode))
+        {
+            emit_record(t, FZ_REC_DEL_TREE, 0, "", 0, item->path, item->pathlen);
+            return;
+        }
+        if(stat_mtime(&sb) == item->mtime)
+            return;
+    }
+
+    if(item->parent != NULL)
+        fd = openat(item->parent->fd, item->path + item->namepos, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if(fd < 0 && item->parent != NULL && (errno == EMFILE || errno == ENFILE))
+        fd = openat(w->base_fd, item->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if(item->parent == NULL)
+        fd = item->pathlen > 0 ? openat(w->base_fd, item->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+                               : dup(w->base_fd);
+    if(fd < 0)
+    {
+        if(item->check)
+            emit_record(t, FZ_REC_DEL_TREE, 0, "", 0, item->path, item->pathlen);
+        return;
+    }
+
+    /* 읽는 중에 바뀌는 것을 놓치지 않도록 읽기 전에 등록 */
+    if(w->watch != NULL && !item->check)
+        watch_dir(w->watch, item->path, item->pathlen);
+
+    /* 바뀐 디렉토리는 바로 아래 항목을 지우고 다시 읽는다. (같은 스레드라 순서 보장) */
+    if(item->check)
+        emit_record(t, FZ_REC_DEL_CHILDREN, 0, "", 0, item->path, item->pathlen);
+    if(w->want_dirs && fstat(fd, &sb) == 0)
+    {
+        /* 순회 직전에 바뀐 디렉토리는 mtime 해상도 때문에 놓칠 수 있으므로 다음에 다시 읽도록 */
+        int64_t mtime = stat_mtime(&sb);
+        if(mtime >= w->start_ns - 2000000000LL)
+            mtime = 0;
+        emit_record(t, FZ_REC_DIR, mtime, "", 0, item->path, item->pathlen);
+    }
+
+    fz_dirref_t* ref = (fz_dirref_t*) malloc (sizeof(fz_dirref_t));
+    if(ref == NULL)
+    {
+        close(fd);
+        return;
+    }
+    ref->fd = fd;
+    ref->refs = 1;
+    t->dirs++;
+
+#if defined(__linux__) && defined(SYS_getdents64)
+    for(;;)
+    {
+        long n = syscall(SYS_getdents64, fd, t->dents, FZ_DENTS_SIZE);
+        if(n <= 0)
+            break;
+        for(long pos = 0; pos < n; )
+        {
+            struct fz_dirent64* ent = (struct fz_dirent64*) (t->dents + pos);
+            walk_entry(t, item, ref, ent->d_name, ent->d_type);
+            pos += ent->d_reclen;
+        }
+    }
+#else
+    int dfd = dup(fd);
+    DIR* dir = dfd >= 0 ? fdopendir(dfd) : NULL;
+    if(dir != NULL)
+    {
+        struct dirent* ent;
+        while( (ent = readdir(dir)) )
+        {
+#ifdef _DIRENT_HAVE_D_TYPE
+            /* Posix 표준이 아니다. GNU에서 제공 */
+            walk_entry(t, item, ref, ent->d_name, ent->d_type);
+#else
+            walk_entry(t, item, ref, ent->d_name, DT_UNKNOWN);
+#endif
+        }
+        closedir(dir);
+    }
+    else if(dfd >= 0)
+        close(dfd);
+#endif
+    release_dirref(ref);
+}
+
+static void* walk_main(void* arg)
+{
+    fz_walk_thread_t* t = (fz_walk_thread_t*) arg;
+    fz_walk_item_t* item;
+
+    t->flushed_ms = now_ms();
+    while( (item = next_walk_item(t->walker, t->id)) != NULL )
+    {
+        walk_dir(t, item);
+        finish_walk_item(t->walker, item);
+        /* 백그라운드 순회면 모인 만큼 자주 넘겨서 화면에 바로 보이도록 */
+        if(t->walker->stream && now_ms() - t->flushed_ms >= FZ_FLUSH_MS)
+            flush_batch(t);
+    }
+    flush_batch(t);
+    return NULL;
+}
+
+static void destroy_walker(fz_walker_t* w);
+
+/* base_path 순회 준비, 실패하면 NULL (nthreads 가 0 이면 fz_get_thread_count) */
+static fz_walker_t* create_walker(char* base_path, int isfile, int nthreads)
+{
+    fz_walker_t* w = (fz_walker_t*) calloc (1, sizeof(fz_walker_t));
+    if(w == NULL)
+        return NULL;
+
+    w->base_fd = open(base_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(w->base_fd < 0)
+    {
+        free(w);
+        return NULL;
+    }
+    w->isfile = isfile;
+    w->nthreads = nthreads > 0 ? nthreads : fz_get_thread_count();
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+
+    w->deques = (fz_deque_t*) calloc (w->nthreads, sizeof(fz_deque_t));
+    w->threads = (fz_walk_thread_t*) calloc (w->nthreads, sizeof(fz_walk_thread_t));
+    if(w->deques == NULL || w->threads == NULL)
+    {
+        destroy_walker(w);
+        return NULL;
+    }
+    for(int i=0; i < w->nthreads; i++)
+    {
+        pthread_mutex_init(&w->deques[i].lock, NULL);
+        w->threads[i].walker = w;
+        w->threads[i].id = i;
+    }
+    /* 잠금을 모두 초기화한 뒤에 할당 (destroy_walker 가 전부 해제) */
+    for(int i=0; i < w->nthreads; i++)
+    {
+        w->threads[i].dents = (char*) malloc (FZ_DENTS_SIZE);
+        if(w->threads[i].dents == NULL)
+        {
+            destroy_walker(w);
+            return NULL;
+        }
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    w->start_ns = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return w;
+}
+
+/*
+    순회할 디렉토리 등록, 실패하면 0
+    check_dirs 가 있으면 (캐시 재검증) 전체 대신 그 디렉토리들의 mtime 만 확인한다.
+*/
+static int add_walk_roots(fz_walker_t* w, fz_hash_t* check_dirs)
+{
+    if(check_dirs == NULL)
+    {
+        fz_walk_item_t* root = new_walk_item(NULL, "", 0, "", 0);
+        if(root == NULL)
+            return 0;
+        push_walk_item(w, 0, root);
+        return 1;
+    }
+
+    int n = 0;
+    for(int i=0; i < check_dirs->cap; i++)
+    {
+        fz_hent_t* e = &(check_dirs->ents[i]);
+        if(e->key == NULL)
+            continue;
+        fz_walk_item_t* item = new_walk_item(NULL, "", 0, e->key, e->len);
+        if(item == NULL || hash_put(&w->known, e->key, e->len) == NULL)
+        {
+            free(item);
+            return 0;
+        }
+        item->check = 1;
+        item->mtime = e->val;
+        push_walk_item(w, n++ % w->nthreads, item);
+    }
+    return 1;
+}
+
+/* 순회 실행, 끝날때까지 반환하지 않음 */
+static void run_walker(fz_walker_t* w)
+{
+    uint64_t t0 = now_ns();
+    /* threads[0] 은 호출 스레드 */
+    int started = 1;
+    for(int i=1; i < w->nthreads; i++)
+    {
+        if(pthread_create(&w->threads[i].tid, NULL, walk_main, &w->threads[i]) != 0)
+            break;
+        started++;
+    }
+    walk_main(&w->threads[0]);
+    for(int i=1; i < started; i++)
+        pthread_join(w->threads[i].tid, NULL);
+    w->walk_ns = now_ns() - t0;
+
+    pthread_mutex_lock(&w->lock);
+    w->finished = 1;
+    pthread_mutex_unlock(&w->lock);
+    notify_load();
+}
+
+/* 끝난 순회의 스레드별 통계를 list 에 합친다. */
+static void add_walk_stats(fscore_list_t* list, fz_walker_t* w)
+{
+    if(!g_stats_on)
+        return;
+    for(int i=0; i < w->nthreads; i++)
+    {
+        list->stats.dirs += w->threads[i].dirs;
+        list->stats.files += w->threads[i].files;
+    }
+    list->stats.walk_ns += w->walk_ns;
+}
+
+static void* walker_master(void* arg)
+{
+    run_walker((fz_walker_t*) arg);
+    return NULL;
+}
+
+static void destroy_walker(fz_walker_t* w)
+{
+    for(int i=0; w->deques != NULL && i < w->nthreads; i++)
+    {
+        fz_deque_t* dq = &(w->deques[i]);
+        /* 중단된 경우 남은 일감 정리 */
+        for(int j = dq->head; j < dq->tail; j++)
+        {
+            release_dirref(dq->items[j % dq->cap]->parent);
+            free(dq->items[j % dq->cap]);
+        }
+        free(dq->items);
+        pthread_mutex_destroy(&dq->lock);
+    }
+    for(int i=0; w->threads != NULL && i < w->nthreads; i++)
+    {
+        if(w->threads[i].batch != NULL)
+            free(w->threads[i].batch);
+        free(w->threads[i].dents);
+    }
+    while(w->done_head != NULL)
+    {
+        fz_batch_t* next = w->done_head->next;
+        free(w->done_head);
+        w->done_head = next;
+    }
+    free(w->deques);
+    free(w->threads);
+    hash_free(&w->known);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    close(w->base_fd);
+    free(w);
+}
+
+/*
+    인덱스 캐시
+
+    - base-path 마다 캐시 파일 하나, 파일명 POOL 을 그대로 mmap 해서 list->_map_pool 로 가리킨다.
+      (캐시에서 읽은 파일명의 위치는 FZ_OFF_MAPPED 표시)
+      POOL 에는 파일명별 shadow(소문자/보너스)까지 같이 저장하고,
+      항목별 메타데이터(길이, 문자 집합, 정렬 키)도 같이 저장해서 다시 구하지 않는다.
+    - 디렉토리별 mtime 을 같이 저장해 두고, 로드 후 백그라운드로 mtime 이 바뀐 디렉토리만 다시 읽는다.
+      . 바뀐 디렉토리: 바로 아래 파일명을 삭제 표시 후 다시 추가, 새로 생긴 하위 디렉토리는 전체 순회
+      . 없어진 디렉토리: 아래 파일명 모두 삭제 표시
+    - 순회가 끝나고 바뀐 것이 있으면 삭제 표시된 것을 빼고 다시 저장 (임시파일 → rename)
+      mmap 중인 예전 파일은 rename 으로 바뀌어도 그대로 유효
+
+    [header][entry 테이블][dir 테이블][파일명 POOL][디렉토리명 POOL]
+    같은 머신에서만 쓰는 파일이라 바이트 순서는 변환하지 않는다.
+*/
+#define FZ_CACHE_MAGIC   "FZIDX\0\0\0"
+#define FZ_CACHE_VERSION (3)
+
+typedef struct fz_cache_hdr_st
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t isfile;
+    uint32_t entry_cnt;
+    uint32_t dir_cnt;
+    uint64_t pool_size;
+    uint64_t dirpool_size;
+    char     base[MAX_PATH_LEN];  /* base 실제 경로 */
+} fz_cache_hdr_t;
+
+typedef struct fz_cache_ent_st
+{
+    uint32_t off;   /* 파일명 POOL 에서의 위치 */
+    uint32_t len;
+    uint32_t lkey;
+    uint32_t pad;
+    uint64_t sig;
+} fz_cache_ent_t;
+
+typedef struct fz_cache_dir_st
+{
+    uint32_t off;   /* 디렉토리명 POOL 에서의 위치 */
+    uint32_t len;
+    int64_t  mtime;
+} fz_cache_dir_t;
+
+typedef struct fz_cache_st
+{
+    char   path[MAX_PATH_LEN + 64];  /* 캐시 파일 */
+    char   base[MAX_PATH_LEN];       /* base 실제 경로 */
+    int    isfile;
+    fz_hash_t dirs;                  /* 디렉토리 → mtime */
+    void*  map;                      /* mmap 한 캐시 파일, 없으면 NULL */
+    size_t map_size;
+    int    dirty;                    /* 다시 저장 필요 */
+    int    mixed;                    /* 순회 중에 감시 이벤트를 반영함, 디렉토리 mtime 을 믿을 수 없어서 저장하지 않음 */
+} fz_cache_t;
+
+static char g_cache_dir[MAX_PATH_LEN] = "";
+
+void fz_set_cache_dir(const char* dir)
+{
+    if(dir == NULL || strlen(dir) >= MAX_PATH_LEN)
+        g_cache_dir[0] = '\0';
+    else
+        strcpy(g_cache_dir, dir);
+}
+
+/* 캐시 파일 내용을 list 에 반영, 파일이 없거나 맞지 않으면 0 */
+static int load_cache(fscore_list_t* list, fz_cache_t* c)
+{
+    int fd = open(c->path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return 0;
+
+    struct stat sb;
+    void* map = MAP_FAILED;
+    if(fstat(fd, &sb) == 0 && (size_t) sb.st_size >= sizeof(fz_cache_hdr_t))
+        map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return 0;
+
+    size_t size = sb.st_size;
+    fz_cache_hdr_t* hdr = (fz_cache_hdr_t*) map;
+    if(memcmp(hdr->magic, FZ_CACHE_MAGIC, 8) != 0 || hdr->version != FZ_CACHE_VERSION ||
+       hdr->isfile != (uint32_t) c->isfile || strncmp(hdr->base, c->base, MAX_PATH_LEN) != 0 ||
+       sizeof(fz_cache_hdr_t) + (uint64_t) hdr->entry_cnt * sizeof(fz_cache_ent_t)
+           + (uint64_t) hdr->dir_cnt * sizeof(fz_cache_dir_t)
+           + hdr->pool_size + hdr->dirpool_size != size)
+    {
+        munmap(map, size);
+        return 0;
+    }
+    fz_cache_ent_t* ents = (fz_cache_ent_t*) (hdr + 1);
+    fz_cache_dir_t* dirs = (fz_cache_dir_t*) (ents + hdr->entry_cnt);
+    char* pool = (char*) (dirs + hdr->dir_cnt);
+    char* dirpool = pool + hdr->pool_size;
+
+    /* 파일명은 mmap 한 POOL 을 그대로 가리킨다. */
+    if(hdr->pool_size >= FZ_OFF_MAPPED)
+        goto fail;
+    list->_map_pool = pool;
+    for(uint32_t i=0; i < hdr->entry_cnt; i++)
+    {
+        fz_cache_ent_t* ent = &(ents[i]);
+        if((uint64_t) ent->off + FZ_SHADOW_SIZE((uint64_t) ent->len) > hdr->pool_size || ent->len >= MAX_PATH_LEN ||
+           pool[ent->off + ent->len] != '\0' ||
+           (list->len >= list->_cap && !grow_list(list)))
+            goto fail;
+        append_entry(list, ent->off | FZ_OFF_MAPPED, ent->len, ent->sig, ent->lkey);
+    }
+    for(uint32_t i=0; i < hdr->dir_cnt; i++)
+    {
+        fz_cache_dir_t* dir = &(dirs[i]);
+        if((uint64_t) dir->off + dir->len >= hdr->dirpool_size || dirpool[dir->off + dir->len] != '\0')
+            goto fail;
+        fz_hent_t* e = hash_put(&c->dirs, dirpool + dir->off, dir->len);
+        if(e == NULL)
+            goto fail;
+        e->val = dir->mtime;
+    }
+
+    c->map = map;
+    c->map_size = size;
+    list->_alloc_size += hdr->pool_size + FZ_ENTRY_SIZE * hdr->entry_cnt;
+    return 1;
+
+fail:
+    list->_map_pool = NULL;
+    list->len = 0;
+    list->cands_cnt = 0;
+    hash_free(&c->dirs);
+    munmap(map, size);
+    return 0;
+}
+
+/* 캐시 사용 준비, 이전에 저장한 캐시가 있으면 list 에 읽어 둔다. */
+static fz_cache_t* open_cache(fscore_list_t* list, char* path, int isfile)
+{
+    char base[PATH_MAX];
+    if(realpath(path, base) == NULL || strlen(base) >= MAX_PATH_LEN)
+        return NULL;
+
+    fz_cache_t* c = (fz_cache_t*) calloc (1, sizeof(fz_cache_t));
+    if(c == NULL)
+        return NULL;
+    strcpy(c->base, base);
+    c->isfile = isfile;
+
+    /* 파일명은 base 경로 해시 */
+    uint64_t h = 14695981039346656037ULL;   /* FNV-1a */
+    for(char* p = base; *p; p++)
+        h = (h ^ (unsigned char) *p) * 1099511628211ULL;
+    snprintf(c->path, sizeof(c->path), "%s/%016llx%c.idx",
+             g_cache_dir, (unsigned long long) h, isfile ? 'f' : 'd');
+
+    list->_cache = c;
+    if(!load_cache(list, c))
+        c->dirty = 1;   /* 처음 순회한 결과를 저장 */
+    return c;
+}
+
+static void make_dirs(char* path)
+{
+    char buf[MAX_PATH_LEN];
+    strcpy(buf, path);
+    for(char* p = buf + 1; *p; p++)
+    {
+        if(*p != '/')
+            continue;
+        *p = '\0';
+        mkdir(buf, 0700);
+        *p = '/';
+    }
+    mkdir(buf, 0700);
+}
+
+/* 바뀐 것이 있으면 캐시 파일 다시 저장 */
+static void save_cache(fscore_list_t* list)
+{
+    fz_cache_t* c = list->_cache;
+    if(c == NULL || !c->dirty || c->mixed)
+        return;
+    c->dirty = 0;
+
+    fz_cache_hdr_t hdr;
+    memset(&hdr, 0x00, sizeof(hdr));
+    memcpy(hdr.magic, FZ_CACHE_MAGIC, 8);
+    hdr.version = FZ_CACHE_VERSION;
+    hdr.isfile = c->isfile;
+    strcpy(hdr.base, c->base);
+    for(int i=0; i < list->len; i++)
+    {
+        if(list->_flags[i] & FZ_ENTRY_DELETED)
+            continue;
+        hdr.entry_cnt++;
+        hdr.pool_size += FZ_SHADOW_SIZE(list->_lens[i]);
+    }
+    for(int i=0; i < c->dirs.cap; i++)
+    {
+        if(c->dirs.ents[i].key == NULL)
+            continue;
+        hdr.dir_cnt++;
+        hdr.dirpool_size += c->dirs.ents[i].len + 1;
+    }
+    /* 위치를 32비트로 저장 */
+    if(hdr.pool_size > UINT32_MAX || hdr.dirpool_size > UINT32_MAX)
+        return;
+
+    make_dirs(g_cache_dir);
+    char tmp[sizeof(c->path) + 16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", c->path, (int) getpid());
+    FILE* fp = fopen(tmp, "wb");
+    if(fp == NULL)
+        return;
+
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    uint32_t off = 0;
+    for(int i=0; i < list->len; i++)
+    {
+        if(list->_flags[i] & FZ_ENTRY_DELETED)
+            continue;
+        fz_cache_ent_t rec = { off, list->_lens[i], list->_lkeys[i], 0, list->_sigs[i] };
+        fwrite(&rec, sizeof(rec), 1, fp);
+        off += FZ_SHADOW_SIZE(list->_lens[i]);
+    }
+    off = 0;
+    for(int i=0; i < c->dirs.cap; i++)
+    {
+        fz_hent_t* e = &(c->dirs.ents[i]);
+        if(e->key == NULL)
+            continue;
+        fz_cache_dir_t rec = { off, e->len, e->val };
+        fwrite(&rec, sizeof(rec), 1, fp);
+        off += e->len + 1;
+    }
+    for(int i=0; i < list->len; i++)
+    {
+        if(!(list->_flags[i] & FZ_ENTRY_DELETED))
+            fwrite(ENT_NAME(list, i), FZ_SHADOW_SIZE(list->_lens[i]), 1, fp);
+    }
+    for(int i=0; i < c->dirs.cap; i++)
+    {
+        if(c->dirs.ents[i].key != NULL)
+            fwrite(c->dirs.ents[i].key, c->dirs.ents[i].len + 1, 1, fp);
+    }
+
+    int ok = !ferror(fp);
+    if(fclose(fp) != 0)
+        ok = 0;
+    if(!ok || rename(tmp, c->path) != 0)
+        unlink(tmp);
+}
+
+static void free_cache(fscore_list_t* list)
+{
+    fz_cache_t* c = list->_cache;
+    if(c == NULL)
+        return;
+    if(c->map != NULL)
+        munmap(c->map, c->map_size);
+    hash_free(&c->dirs);
+    free(c);
+    list->_cache = NULL;
+}
+
+/* 삭제 예정인 경로 */
+typedef struct fz_delset_st
+{
+    fz_hash_t children;  /* 바로 아래 파일명을 지울 디렉토리 */
+    fz_hash_t tree;      /* 아래 파일명을 모두 지울 디렉토리 (캐시의 디렉토리도 같이 지운다) */
+} fz_delset_t;
+
+static int in_delset(fz_delset_t* del, char* path, int len)
+{
+    if(del->children.cnt > 0)
+    {
+        int dirlen = len - 1;
+        while(dirlen > 0 && path[dirlen] != '/')
+            dirlen--;
+        if(hash_find(&del->children, path, dirlen) != NULL)
+            return 1;
+    }
+    if(del->tree.cnt > 0 && hash_find(&del->tree, "", 0) != NULL)
+        return 1;
+    for(int i=1; del->tree.cnt > 0 && i < len; i++)
+    {
+        if(path[i] == '/' && hash_find(&del->tree, path, i) != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+    삭제 예정인 파일명을 삭제 표시, 표시한 개수 반환
+    skip_flag 가 있는 파일명은 건너뛴다. (순회 결과보다 나중에 감시에서 확인한 것)
+    캐시가 있으면 없어진 디렉토리도 캐시에서 한번에 지운다.
+*/
+static int apply_deletes(fscore_list_t* list, fz_delset_t* del, int skip_flag)
+{
+    int cnt = 0;
+    if(del->children.cnt == 0 && del->tree.cnt == 0)
+        return 0;
+
+    if(list->_cache != NULL)
+        hash_remove_trees(&list->_cache->dirs, &del->tree);
+
+    for(int i=0; i < list->len; i++)
+    {
+        if(!(list->_flags[i] & (FZ_ENTRY_DELETED | skip_flag)) &&
+           in_delset(del, ENT_NAME(list, i), list->_lens[i]))
+        {
+            list->_flags[i] |= FZ_ENTRY_DELETED;
+            cnt++;
+        }
+    }
+    list->_dead += cnt;
+    hash_free(&del->children);
+    hash_free(&del->tree);
+    return cnt;
+}
+
+/* 삭제 표시된 파일명을 후보와 후보 스택에서 뺀다. (정렬된 앞부분은 그대로 정렬 상태) */
+static void drop_deleted(fscore_list_t* list)
+{
+    int cnt = 0;
+    int ordered = 0;
+    for(int i=0; i < list->cands_cnt; i++)
+    {
+        if(list->_flags[list->cands[i]] & FZ_ENTRY_DELETED)
+            continue;
+        if(i < list->_ordered)
+            ordered++;
+        list->cands[cnt++] = list->cands[i];
+    }
+    list->cands_cnt = cnt;
+    list->_ordered = ordered;
+    list->_heaped = 0;
+
+    for(int lv=0; lv < list->_level_cnt; lv++)
+    {
+        fz_level_t* level = &(list->_levels[lv]);
+        cnt = 0;
+        ordered = 0;
+        for(int i=0; i < level->cnt; i++)
+        {
+            if(list->_flags[level->cands[i]] & FZ_ENTRY_DELETED)
+                continue;
+            if(i < level->ordered)
+                ordered++;
+            level->scores[cnt] = level->scores[i];
+            level->cands[cnt++] = level->cands[i];
+        }
+        level->cnt = cnt;
+        level->ordered = ordered;
+        level->heaped = 0;
+    }
+}
+
+/*
+    감시 모드 (inotify, 리눅스만)
+
+    - 순회하는 디렉토리마다 읽기 전에 감시를 등록하고, 감시 스레드가 이벤트를 레코드로 바꿔서 batch 로 넘긴다.
+      . 생성/이동해 온 파일: FZ_REC_ENTRY, 디렉토리면 감시 스레드에서 그 아래를 순회
+      . 삭제/이동해 간 파일: FZ_REC_DEL_ENTRY, 디렉토리면 FZ_REC_DEL_TREE 도
+      . 이벤트 큐가 넘치면 전체 삭제 후 다시 순회
+    - list 에는 fz_load_poll 에서 순회 결과와 같은 방식으로 반영 (바뀐 파일명만 다시 계산)
+    - 경로 → 파일명 번호 인덱스로 중복 추가를 막고 삭제할 파일명을 바로 찾는다.
+    - 처음 순회가 끝나기 전에 감시에서 삭제한 경로는 순회 결과에 뒤늦게 나와도 추가하지 않는다. (orphans)
+      삭제 후 다시 생긴 것은 감시 스레드가 다시 알려준다.
+    - 반대로 감시에서 확인한 파일명은 뒤늦게 넘어온 순회 결과(캐시 재검증)의 삭제를 적용하지 않는다.
+*/
+#define FZ_WATCH_MASK  (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                        IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+#define FZ_EVENT_SIZE  (64 * 1024)
+
+typedef struct fz_watch_st
+{
+    /* 감시 스레드 */
+    int  ifd;             /* inotify */
+    int  stop[2];         /* 종료 알림 pipe */
+    pthread_t tid;
+    int  started;
+    char base[PATH_MAX];  /* base 실제 경로 */
+    fz_walker_t* w;       /* 새 디렉토리 순회 및 결과 batch */
+
+    pthread_mutex_t lock; /* wd_paths 보호 */
+    char** wd_paths;      /* watch descriptor → base 기준 상대경로 */
+    int  wd_cap;
+
+    /* 경로 인덱스, fz_load_poll 스레드에서만 사용 */
+    int* slots;           /* 파일명 번호, -1 이면 빈칸 */
+    int  slot_cap;
+    int  slot_cnt;
+    int  indexed;         /* 파일명 [0, indexed) 까지 인덱스에 있음 */
+
+    fz_hash_t orphans;       /* 순회 중에 삭제된 경로 */
+    fz_hash_t orphan_trees;  /* 순회 중에 삭제된 디렉토리 */
+} fz_watch_t;
+
+/* 감시에서 확인한 파일명, 순회 결과의 삭제는 적용하지 않는다. */
+#define FZ_ENTRY_WATCHED (2)
+
+static int g_watch = 0;
+
+void fz_set_watch(int on)
+{
+    g_watch = on;
+}
+
+int fz_watch_active( fscore_list_t* list )
+{
+    return list->_watch != NULL;
+}
+
+#ifdef __linux__
+static void watch_dir(fz_watch_t* wt, char* path, int pathlen)
+{
+    char full[PATH_MAX + MAX_PATH_LEN + 1];
+    snprintf(full, sizeof(full), "%s%s%s", wt->base, pathlen > 0 ? "/" : "", path);
+
+    int wd = inotify_add_watch(wt->ifd, full, FZ_WATCH_MASK);
+    if(wd < 0)
+        return;   /* 감시 개수 제한 (max_user_watches) 등, 그 디렉토리는 감시하지 않음 */
+
+    pthread_mutex_lock(&wt->lock);
+    if(wd >= wt->wd_cap)
+    {
+        int cap = wt->wd_cap ? wt->wd_cap : 256;
+        while(cap <= wd)
+            cap *= 2;
+        char** paths = (char**) realloc (wt->wd_paths, sizeof(char*) * cap);
+        if(paths == NULL)
+        {
+            pthread_mutex_unlock(&wt->lock);
+            inotify_rm_watch(wt->ifd, wd);
+            return;
+        }
+        memset(paths + wt->wd_cap, 0x00, sizeof(char*) * (cap - wt->wd_cap));
+        wt->wd_paths = paths;
+        wt->wd_cap = cap;
+    }
+    /* 이동한 디렉토리는 같은 wd 로 돌아오므로 경로를 바꾼다. */
+    free(wt->wd_paths[wd]);
+    wt->wd_paths[wd] = strdup(path);
+    pthread_mutex_unlock(&wt->lock);
+}
+
+/* dir 아래 감시 해제 (밖으로 이동한 디렉토리) */
+static void unwatch_tree(fz_watch_t* wt, char* dir, int dirlen)
+{
+    pthread_mutex_lock(&wt->lock);
+    for(int wd=0; wd < wt->wd_cap; wd++)
+    {
+        char* path = wt->wd_paths[wd];
+        if(path != NULL && is_under(path, strlen(path), dir, dirlen))
+        {
+            inotify_rm_watch(wt->ifd, wd);
+            free(path);
+            wt->wd_paths[wd] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&wt->lock);
+}
+
+/* 감시 스레드에서 새 디렉토리 아래를 순회 (결과는 같은 batch 에 이어서 기록) */
+static void watch_walk(fz_watch_t* wt, char* path, int pathlen)
+{
+    fz_walk_item_t* item = new_walk_item(NULL, "", 0, path, pathlen);
+    if(item == NULL)
+        return;
+    push_walk_item(wt->w, 0, item);
+    walk_main(&(wt->w->threads[0]));
+}
+
+static void watch_event(fz_watch_t* wt, fz_walk_thread_t* t, struct inotify_event* ev)
+{
+    char path[MAX_PATH_LEN];
+    int  pathlen;
+
+    if(ev->mask & IN_Q_OVERFLOW)
+    {
+        /* 놓친 이벤트가 있으므로 전체를 다시 읽는다. */
+        emit_record(t, FZ_REC_DEL_TREE, 0, "", 0, "", 0);
+        watch_walk(wt, "", 0);
+        return;
+    }
+
+    pthread_mutex_lock(&wt->lock);
+    char* dir = ev->wd >= 0 && ev->wd < wt->wd_cap ? wt->wd_paths[ev->wd] : NULL;
+    if(ev->mask & IN_IGNORED)
+    {
+        /* 디렉토리가 삭제되어 감시가 해제됨 */
+        free(dir);
+        if(dir != NULL)
+            wt->wd_paths[ev->wd] = NULL;
+        dir = NULL;
+    }
+    pathlen = dir != NULL ? snprintf(path, sizeof(path), "%s%s%s", dir, dir[0] ? "/" : "", ev->len > 0 ? ev->name : "") : -1;
+    pthread_mutex_unlock(&wt->lock);
+
+    if(pathlen < 0 || ev->len == 0 || pathlen >= MAX_PATH_LEN)
+        return;
+
+    int isdir = (ev->mask & IN_ISDIR) != 0;
+    if(ev->mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        emit_record(t, FZ_REC_DEL_ENTRY, 0, "", 0, path, pathlen);
+        if(isdir)
+        {
+            emit_record(t, FZ_REC_DEL_TREE, 0, "", 0, path, pathlen);
+            if(ev->mask & IN_MOVED_FROM)
+                unwatch_tree(wt, path, pathlen);
+        }
+    }
+    if(ev->mask & (IN_CREATE | IN_MOVED_TO))
+    {
+        if(isdir)
+        {
+            if(!wt->w->isfile)
+                emit_record(t, FZ_REC_ENTRY, 0, "", 0, path, pathlen);
+            watch_walk(wt, path, pathlen);
+        }
+        else if(wt->w->isfile)
+            emit_record(t, FZ_REC_ENTRY, 0, "", 0, path, pathlen);
+    }
+}
+
+static void* watch_main(void* arg)
+{
+    fz_watch_t* wt = (fz_watch_t*) arg;
+    fz_walk_thread_t* t = &(wt->w->threads[0]);
+    char* buf = (char*) malloc (FZ_EVENT_SIZE);
+    if(buf == NULL)
+        return NULL;
+
+    for(;;)
+    {
+        struct pollfd fds[2];
+        fds[0].fd = wt->ifd;
+        fds[0].events = POLLIN;
+        fds[1].fd = wt->stop[0];
+        fds[1].events = POLLIN;
+        if(poll(fds, 2, -1) < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+        if(fds[1].revents)
+            break;
+
+        ssize_t n = read(wt->ifd, buf, FZ_EVENT_SIZE);
+        if(n <= 0)
+        {
+            if(n < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            break;
+        }
+        for(char* p = buf; p < buf + n; )
+        {
+            struct inotify_event* ev = (struct inotify_event*) p;
+            watch_event(wt, t, ev);
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+        /* 읽은 이벤트만큼 바로 넘긴다. */
+        flush_batch(t);
+    }
+    free(buf);
+    return NULL;
+}
+
+/* 감시 준비, 스레드는 start_watch 에서 시작 */
+static fz_watch_t* create_watch(char* path, int isfile)
+{
+    fz_watch_t* wt = (fz_watch_t*) calloc (1, sizeof(fz_watch_t));
+    if(wt == NULL)
+        return NULL;
+    wt->ifd = -1;
+    wt->stop[0] = wt->stop[1] = -1;
+    pthread_mutex_init(&wt->lock, NULL);
+
+    if(realpath(path, wt->base) == NULL ||
+       (wt->ifd = inotify_init1(IN_CLOEXEC)) < 0 || pipe(wt->stop) != 0 ||
+       (wt->w = create_walker(path, isfile, 1)) == NULL)
+    {
+        if(wt->ifd >= 0)
+            close(wt->ifd);
+        if(wt->stop[0] >= 0)
+        {
+            close(wt->stop[0]);
+            close(wt->stop[1]);
+        }
+        pthread_mutex_destroy(&wt->lock);
+        free(wt);
+        return NULL;
+    }
+    wt->w->watch = wt;
+    return wt;
+}
+
+static int start_watch(fz_watch_t* wt)
+{
+    wt->started = pthread_create(&wt->tid, NULL, watch_main, wt) == 0;
+    return wt->started;
+}
+
+static void stop_watch( fscore_list_t* list )
+{
+    fz_watch_t* wt = list->_watch;
+    if(wt == NULL)
+        return;
+
+    if(wt->started)
+    {
+        __sync_fetch_and_add(&wt->w->abort, 1);
+        ssize_t ret = write(wt->stop[1], "x", 1);
+        (void) ret;
+        pthread_join(wt->tid, NULL);
+    }
+    destroy_walker(wt->w);
+    close(wt->ifd);
+    close(wt->stop[0]);
+    close(wt->stop[1]);
+    for(int i=0; i < wt->wd_cap; i++)
+        free(wt->wd_paths[i]);
+    free(wt->wd_paths);
+    free(wt->slots);
+    hash_free(&wt->orphans);
+    hash_free(&wt->orphan_trees);
+    pthread_mutex_destroy(&wt->lock);
+    free(wt);
+    list->_watch = NULL;
+}
+#else
+static void watch_dir(fz_watch_t* wt, char* path, int pathlen)
+{
+}
+
+static fz_watch_t* create_watch(char* path, int isfile)
+{
+    return NULL;
+}
+
+static int start_watch(fz_watch_t* wt)
+{
+    return 0;
+}
+
+static void stop_watch( fscore_list_t* list )
+{
+}
+#endif
+
+/* 인덱스에 파일명 idx 추가 (꽉 차면 삭제 표시된 것을 빼고 다시 만든다) */
+static void pathidx_add(fz_watch_t* wt, fscore_list_t* list, int idx)
+{
+    if((wt->slot_cnt + 1) * 2 > wt->slot_cap)
+    {
+        int live = 0;
+        for(int i=0; i < wt->indexed; i++)
+            if(!(list->_flags[i] & FZ_ENTRY_DELETED))
+                live++;
+        int cap = 1024;
+        while(cap < (live + 1) * 4)
+            cap *= 2;
+        int* slots = (int*) malloc (sizeof(int) * cap);
+        if(slots == NULL)
+            return;
+        memset(slots, 0xFF, sizeof(int) * cap);
+        free(wt->slots);
+        wt->slots = slots;
+        wt->slot_cap = cap;
+        wt->slot_cnt = 0;
+        for(int i=0; i < wt->indexed; i++)
+            if(i != idx && !(list->_flags[i] & FZ_ENTRY_DELETED))
+                pathidx_add(wt, list, i);
+    }
+
+    int i = hash_str(ENT_NAME(list, idx), list->_lens[idx]) & (wt->slot_cap - 1);
+    while(wt->slots[i] >= 0)
+        i = (i + 1) & (wt->slot_cap - 1);
+    wt->slots[i] = idx;
+    wt->slot_cnt++;
+}
+
+/* 삭제 표시되지 않은 path 의 파일명 번호, 없으면 -1 */
+static int pathidx_find(fz_watch_t* wt, fscore_list_t* list, char* path, int len)
+{
+    /* 인덱스 이후 추가된 것 반영 */
+    while(wt->indexed < list->len)
+        pathidx_add(wt, list, wt->indexed++);
+    if(wt->slot_cap == 0)
+        return -1;
+
+    for(int i = hash_str(path, len) & (wt->slot_cap - 1); wt->slots[i] >= 0; i = (i + 1) & (wt->slot_cap - 1))
+    {
+        int idx = wt->slots[i];
+        if(list->_lens[idx] == len && !(list->_flags[idx] & FZ_ENTRY_DELETED) &&
+           memcmp(ENT_NAME(list, idx), path, len) == 0)
+            return idx;
+    }
+    return -1;
+}
+
+/* 순회 결과중 감시에서 이미 삭제된 경로인지 */
+static int is_orphan(fz_watch_t* wt, char* path, int len)
+{
+    if(wt->orphans.cnt > 0 && hash_find(&wt->orphans, path, len) != NULL)
+        return 1;
+    if(wt->orphan_trees.cnt > 0 && hash_find(&wt->orphan_trees, "", 0) != NULL)
+        return 1;
+    for(int i=1; wt->orphan_trees.cnt > 0 && i < len; i++)
+    {
+        if(path[i] == '/' && hash_find(&wt->orphan_trees, path, i) != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+
+/*
+    넘겨받은 batch 를 list 에 반영, 추가된 개수 반환 (삭제 표시한 개수는 deleted)
+    삭제는 모아 두었다가 한번에 적용하고, 삭제 예정인 경로가 다시 추가될 때만 미리 적용한다.
+    감시 모드면 이미 있는 경로는 추가하지 않는다.
+*/
+static int drain_walker(fz_walker_t* w, fscore_list_t* list, int* deleted)
+{
+    fz_watch_t* wt = list->_watch;
+    int from_watch = wt != NULL && w == wt->w;
+    int skip_flag = from_watch ? 0 : FZ_ENTRY_WATCHED;
+    fz_delset_t del;
+    int added = 0;
+    int removed = 0;
+    int idx;
+
+    memset(&del, 0x00, sizeof(del));
+
+    pthread_mutex_lock(&w->lock);
+    fz_batch_t* batch = w->done_head;
+    w->done_head = NULL;
+    w->done_tail = NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    while(batch != NULL)
+    {
+        fz_batch_t* next = batch->next;
+        char* p = batch->buf;
+        for(int i=0; i < batch->cnt; i++)
+        {
+            int kind = *p++;
+            int64_t mtime = 0;
+            if(kind == FZ_REC_DIR)
+            {
+                memcpy(&mtime, p, sizeof(int64_t));
+                p += sizeof(int64_t);
+            }
+            int len = strlen(p);
+            fz_hent_t* e;
+
+            switch(kind)
+            {
+                case FZ_REC_ENTRY:
+                    w->drained++;
+                    if(in_delset(&del, p, len))
+                        removed += apply_deletes(list, &del, skip_flag);
+                    if(wt == NULL)
+                    {
+                        added += add_list(list, p);
+                        break;
+                    }
+                    if(!from_watch && is_orphan(wt, p, len))
+                        break;
+                    if((idx = pathidx_find(wt, list, p, len)) < 0 && add_list(list, p))
+                    {
+                        idx = list->len - 1;
+                        added++;
+                    }
+                    if(idx >= 0 && from_watch)
+                        list->_flags[idx] |= FZ_ENTRY_WATCHED;
+                    break;
+                case FZ_REC_DEL_ENTRY:
+                    if(wt == NULL)
+                        break;
+                    if((idx = pathidx_find(wt, list, p, len)) >= 0)
+                    {
+                        list->_flags[idx] |= FZ_ENTRY_DELETED;
+                        list->_dead++;
+                        removed++;
+                    }
+                    else if(list->_walker != NULL)
+                        hash_put(&wt->orphans, p, len);
+                    break;
+                case FZ_REC_DIR:
+                    /* 지울 디렉토리가 다시 생긴 경우 지우기를 먼저 적용 */
+                    if(list->_cache != NULL && in_trees(&del.tree, p, len))
+                        removed += apply_deletes(list, &del, skip_flag);
+                    if(list->_cache != NULL && (e = hash_put(&list->_cache->dirs, p, len)) != NULL)
+                        e->val = mtime;
+                    break;
+                case FZ_REC_DEL_CHILDREN:
+                    hash_put(&del.children, p, len);
+                    break;
+                case FZ_REC_DEL_TREE:
+                    hash_put(&del.tree, p, len);
+                    if(from_watch && list->_walker != NULL)
+                        hash_put(&wt->orphan_trees, p, len);
+                    break;
+            }
+            p += len + 1;
+        }
+        if(batch->cnt > 0 && list->_cache != NULL)
+            list->_cache->dirty = 1;
+        if(batch->cnt > 0 && from_watch && list->_walker != NULL && list->_cache != NULL)
+            list->_cache->mixed = 1;
+        free(batch);
+        batch = next;
+    }
+    removed += apply_deletes(list, &del, skip_flag);
+    if(deleted != NULL)
+        *deleted = removed;
+    return added;
+}
+
+/*
+    캐시가 있으면 캐시를 읽어 두고 재검증, 없으면 전체 순회하는 walker 준비
+    감시 모드면 감시도 시작한다.
+*/
+static fz_walker_t* prepare_walker(fscore_list_t* list, char* path, int isfile)
+{
+    fz_cache_t* c = g_cache_dir[0] != '\0' ? open_cache(list, path, isfile) : NULL;
+
+    fz_walker_t* w = create_walker(path, isfile, 0);
+    if(w == NULL)
+        return NULL;
+    if(!add_walk_roots(w, c != NULL && c->map != NULL ? &c->dirs : NULL))
+    {
+        destroy_walker(w);
+        return NULL;
+    }
+    w->want_dirs = c != NULL;
+
+    fz_watch_t* wt = g_watch ? create_watch(path, isfile) : NULL;
+    if(wt != NULL)
+    {
+        wt->w->want_dirs = c != NULL;
+        list->_watch = wt;
+        if(start_watch(wt))
+            w->watch = wt;
+        else
+            stop_watch(list);
+    }
+    return w;
+}
+
+/* 순회 결과를 모두 반영하고 정리 */
+static void finish_walker(fscore_list_t* list, fz_walker_t* w)
+{
+    int deleted = 0;
+    drain_walker(w, list, &deleted);
+    add_walk_stats(list, w);
+    destroy_walker(w);
+    if(list->_watch != NULL)
+    {
+        hash_free(&list->_watch->orphans);
+        hash_free(&list->_watch->orphan_trees);
+    }
+    if(deleted > 0)
+        drop_deleted(list);
+    save_cache(list);
+}
+
+
+void load_file_list( fscore_list_t* list, char* path, int isfile )
+{
+    if(!init_list(list))
+        return;
+
+    fz_walker_t* w = prepare_walker(list, path, isfile);
+    if(w != NULL)
+    {
+        run_walker(w);
+        /* 스레드별 결과 합치기 */
+        finish_walker(list, w);
+    }
+
+    /* 후보정렬 */
+    list->_ordered = 0;
+    list->_heaped = 0;
+    fz_order_candidates( list, list->cands_cnt );
+}
+
+
+void clear_file_list(fscore_list_t* list)
+{
+    clear_list(list);
+}
+
+
+/*
+    백그라운드 로드
+
+    - 순회는 별도 스레드(walker_master)에서 하고, 찾은 파일명은 batch 로 넘겨받는다.
+    - list 는 fz_load_poll 을 호출하는 스레드에서만 변경한다.
+      (추가하면서 현재 패턴으로 새 파일명만 퍼지점수를 구해서 후보에 넣는다.)
+*/
+int fz_load_start( fscore_list_t* list, char* path, int isfile )
+{
+    if(!init_list(list))
+        return 0;
+
+    /* 캐시가 있으면 여기서 바로 읽고, 백그라운드로는 재검증만 한다. */
+    fz_walker_t* w = prepare_walker(list, path, isfile);
+    if(w == NULL)
+        return 0;
+    w->stream = 1;
+    if(pthread_create(&w->master, NULL, walker_master, w) != 0)
+    {
+        /* 스레드를 만들 수 없으면 그냥 다 읽는다. */
+        run_walker(w);
+        finish_walker(list, w);
+        return 0;
+    }
+    list->_walker = w;
+    return 1;
+}
+
+int fz_load_busy( fscore_list_t* list )
+{
+    return list->_walker != NULL;
+}
+
+int fz_load_found( fscore_list_t* list )
+{
+    int cnt = list->len - list->_dead;
+    if(list->_walker != NULL)
+        cnt += __sync_fetch_and_add(&list->_walker->found, 0) - list->_walker->drained;
+    return cnt;
+}
+
+static void stop_loading( fscore_list_t* list )
+{
+    fz_walker_t* w = list->_walker;
+    if(w == NULL)
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    __sync_fetch_and_add(&w->abort, 1);
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->master, NULL);
+    destroy_walker(w);
+    list->_walker = NULL;
+}
+
+
+
+/*
+    병렬 퍼지점수 계산
+
+    - 워커 풀은 처음 병렬계산이 필요할 때 한번 생성해서 계속 재사용
+    - 워커마다 행 버퍼를 따로 가지므로 서로 간섭하지 않음
+    - list->scores 를 FZ_CHUNK_SIZE 단위 조각으로 나누고, 워커는 다음 조각번호를 가져가서 계산
+    - 조각 i 의 후보는 list->cands[i * FZ_CHUNK_SIZE] 부터 채워 두었다가
+      모두 끝나면 앞으로 당겨서 합친다. (직렬 계산과 후보 순서가 같다)
+    - 풀은 한번에 한 작업만 실행, 다른 스레드가 사용 중이면 호출 스레드에서 직렬로 계산
+      (fz_query 를 여러 스레드에서 동시에 호출하는 경우)
+*/
+#define FZ_CHUNK_SIZE    (2048)
+#define FZ_PARALLEL_MIN  (16384)  /* 이보다 작은 리스트는 직렬로 계산 */
+#define FZ_MAX_THREADS   (64)
+
+typedef struct fz_worker_st
+{
+    pthread_t tid;
+    int* _row;       /* 점수만 계산하므로 한 행 */
+    int* _row_cont;
+    fz_lanes_t* _lanes;   /* SIMD 계산용, NULL 이면 fuzzy_score_only 만 사용 */
+} fz_worker_t;
+
+typedef struct fz_pool_st
+{
+    pthread_mutex_t run_lock;   /* 작업 하나씩 (trylock) */
+    pthread_mutex_t lock;
+    pthread_cond_t  cond_job;
+    pthread_cond_t  cond_done;
+
+    fz_worker_t* workers;
+    int  nthreads;       /* 호출 스레드 포함 */
+    int  generation;     /* 작업이 들어올 때마다 증가 */
+    int  running;        /* 작업중인 워커 수 */
+
+    void (*job)(fz_worker_t* worker, void* arg);
+    void* arg;
+} fz_pool_t;
+
+static fz_pool_t g_pool;
+static int g_thread_cnt = 0;   /* 0이면 FZ_THREADS 환경변수 또는 CPU 개수 */
+
+static void* pool_main(void* arg)
+{
+    fz_worker_t* worker = (fz_worker_t*) arg;
+    int generation = 0;
+
+    pthread_mutex_lock(&g_pool.lock);
+    for(;;)
+    {
+        while(g_pool.generation == generation)
+            pthread_cond_wait(&g_pool.cond_job, &g_pool.lock);
+        generation = g_pool.generation;
+        pthread_mutex_unlock(&g_pool.lock);
+
+        g_pool.job(worker, g_pool.arg);
+
+        pthread_mutex_lock(&g_pool.lock);
+        if(--g_pool.running == 0)
+            pthread_cond_signal(&g_pool.cond_done);
+    }
+    return NULL;
+}
+
+static int alloc_worker(fz_worker_t* worker)
+{
+    worker->_row      = (int*) malloc (sizeof(int) * (MAX_PATH_LEN + 1));
+    worker->_row_cont = (int*) malloc (sizeof(int) * (MAX_PATH_LEN + 1));
+    worker->_lanes    = alloc_lanes();
+    return worker->_row != NULL && worker->_row_cont != NULL;
+}
+
+void fz_set_thread_count(int cnt)
+{
+    /* 풀이 만들어진 후에는 변경하지 않는다. */
+    if(g_pool.workers == NULL)
+        g_thread_cnt = cnt;
+}
+
+int fz_get_thread_count(void)
+{
+    if(g_pool.workers != NULL)
+        return g_pool.nthreads;
+
+    int cnt = g_thread_cnt;
+    if(cnt <= 0)
+    {
+        char* env = getenv("FZ_THREADS");
+        if(env)
+            cnt = atoi(env);
+    }
+    if(cnt <= 0)
+        cnt = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(cnt <= 0)
+        cnt = 1;
+    if(cnt > FZ_MAX_THREADS)
+        cnt = FZ_MAX_THREADS;
+    return cnt;
+}
+
+/* 워커 풀 생성, 실패하면 직렬로만 동작 */
+static void create_pool(void)
+{
+    int cnt = fz_get_thread_count();
+    if(cnt <= 1)
+        return;
+
+    fz_worker_t* workers = (fz_worker_t*) calloc (cnt, sizeof(fz_worker_t));
+    if(workers == NULL)
+        return;
+    g_pool.workers = workers;
+    pthread_mutex_init(&g_pool.run_lock, NULL);
+    pthread_mutex_init(&g_pool.lock, NULL);
+    pthread_cond_init(&g_pool.cond_job, NULL);
+    pthread_cond_init(&g_pool.cond_done, NULL);
+    g_pool.nthreads = 1;
+
+    /* workers[0] 은 호출 스레드가 사용 */
+    if(!alloc_worker(&g_pool.workers[0]))
+        return;
+    for(int i=1; i < cnt; i++)
+    {
+        if(!alloc_worker(&g_pool.workers[i]))
+            break;
+        if(pthread_create(&g_pool.workers[i].tid, NULL, pool_main, &g_pool.workers[i]) != 0)
+            break;
+        g_pool.nthreads++;
+    }
+}
+
+/* 여러 스레드에서 처음 호출해도 한번만 생성 */
+static int init_pool(void)
+{
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, create_pool);
+    return g_pool.nthreads > 1 ? g_pool.nthreads : 1;
+}
+
+/* 모든 워커(호출 스레드 포함)에서 job 을 실행하고 끝날때까지 대기 */
+static void run_pool(void (*job)(fz_worker_t* worker, void* arg), void* arg)
+{
+    pthread_mutex_lock(&g_pool.lock);
+    g_pool.job = job;
+    g_pool.arg = arg;
+    g_pool.running = g_pool.nthreads - 1;
+    g_pool.generation++;
+    pthread_cond_broadcast(&g_pool.cond_job);
+    pthread_mutex_unlock(&g_pool.lock);
+
+    job(&g_pool.workers[0], arg);
+
+    pthread_mutex_lock(&g_pool.lock);
+    while(g_pool.running > 0)
+        pthread_cond_wait(&g_pool.cond_done, &g_pool.lock);
+    pthread_mutex_unlock(&g_pool.lock);
+}
+
+
+#ifdef FZ_SIMD
+/*
+    모아둔 파일명 ents[0, n) 를 SIMD 로 계산해서 성공한 것을 out 에 기록, 기록된 개수 반환
+    점수는 out_scores 가 있으면 out 과 같은 위치, 없으면 list->scores 에 기록
+*/
+static int score_group(fz_scorer_t* sc, fz_lanes_fn fn, fz_lanes_t* lanes, fscore_list_t* list,
+                       char* pat, uint32_t* ents, int n, uint32_t* out, int* out_scores)
+{
+    int res[FZ_LANES];
+    int cnt = 0;
+
+    fn(sc, lanes, pat, fill_lanes(sc, lanes, list, ents, n), res);
+    for(int k=0; k < n; k++)
+    {
+        if(out_scores == NULL)
+            list->scores[ents[k]] = res[k] < 0 ? 0 : res[k];
+        if(res[k] < 0)
+            continue;
+        if(out_scores != NULL)
+            out_scores[cnt] = res[k];
+        out[cnt++] = ents[k];
+    }
+    return cnt;
+}
+#endif
+
+/*
+    파일명 인덱스 src[from, to) 범위의 퍼지점수를 구해서 성공한 것을 out 에 기록
+    src 가 NULL 이면 파일명 [from, to) 가 대상
+    가중치는 sc, 버퍼는 row_score/row_cont/lanes 를 사용
+    lanes 가 있고 CPU 가 지원하면 사전필터를 통과한 것을 FZ_LANES 개씩 모아서 SIMD 로 계산
+    (후보 순서는 그대로)
+    out_scores 가 있으면 점수를 out 과 같은 위치에 기록하고 list 는 바꾸지 않는다. (fz_query)
+    기록된 후보 개수를 반환
+*/
+/* 행 버퍼(MAX_PATH_LEN)보다 긴 항목용 버퍼, score_range 한번 동안 재사용 */
+typedef struct fz_longbuf_st
+{
+    int*  row;
+    int*  cont;
+    char* shadow;
+    int   cap;
+} fz_longbuf_t;
+
+static int grow_longbuf(fz_longbuf_t* lb, int len)
+{
+    if(len <= lb->cap)
+        return 1;
+    int* row = (int*) realloc (lb->row, sizeof(int) * (len + 1));
+    if(row == NULL)
+        return 0;
+    lb->row = row;
+    int* cont = (int*) realloc (lb->cont, sizeof(int) * (len + 1));
+    if(cont == NULL)
+        return 0;
+    lb->cont = cont;
+    char* shadow = (char*) realloc (lb->shadow, FZ_SHADOW_SIZE((size_t) len));
+    if(shadow == NULL)
+        return 0;
+    lb->shadow = shadow;
+    lb->cap = len;
+    return 1;
+}
+
+static int score_range(fz_scorer_t* sc, int* row_score, int* row_cont, fz_lanes_t* lanes,
+                       fscore_list_t* list, uint32_t* src, char* pat, uint64_t patsig,
+                       int from, int to, uint32_t* out, int* out_scores, fz_stats_t* st)
+{
+    int cnt = 0;
+    int patlen = strlen(pat);
+    uint64_t scored = 0, rejects = 0, dp_calls = 0, cells = 0;
+    fz_longbuf_t lb;
+    memset(&lb, 0x00, sizeof(lb));
+#ifdef FZ_SIMD
+    fz_lanes_fn fn = lanes ? get_lanes_fn(sc) : NULL;
+    uint32_t group[FZ_LANES];
+    int group_cnt = 0;
+#endif
+
+    for(int i=from; i < to; i++)
+    {
+        uint32_t ent = src ? src[i] : (uint32_t) i;
+        int score = 0;
+
+        if(list->_flags[ent] & FZ_ENTRY_DELETED)
+            continue;
+        scored++;
+
+        /* 패턴 문자가 하나라도 없으면 계산할 필요 없음 */
+        if( (list->_sigs[ent] & patsig) != patsig )
+        {
+            if(out_scores == NULL)
+                list->scores[ent] = 0;
+            rejects++;
+            continue;
+        }
+
+        int len = list->_lens[ent];
+        dp_calls++;
+        cells += (uint64_t) patlen * len;
+#ifdef FZ_SIMD
+        if(fn && len <= MAX_PATH_LEN)
+        {
+            group[group_cnt++] = ent;
+            if(group_cnt == FZ_LANES)
+            {
+                cnt += score_group(sc, fn, lanes, list, pat, group, group_cnt,
+                                   &out[cnt], out_scores ? &out_scores[cnt] : NULL);
+                group_cnt = 0;
+            }
+            continue;
+        }
+        /* 순서를 유지하기 위해 모아둔 것부터 계산 */
+        if(group_cnt > 0)
+        {
+            cnt += score_group(sc, fn, lanes, list, pat, group, group_cnt,
+                                   &out[cnt], out_scores ? &out_scores[cnt] : NULL);
+            group_cnt = 0;
+        }
+#endif
+
+        /* 위치는 화면에 그릴 때만 구하므로 점수만 계산 */
+        /* 행 버퍼보다 긴 항목은 길이만큼 버퍼를 따로 잡는다. (메모리 부족이면 앞부분만, fz_score 와 같은 기준) */
+        char* name = ENT_NAME(list, ent);
+        char* lower = ENT_LOWER(name, len);
+        unsigned char* bonus = ENT_BONUS(name, len);
+        int* row = row_score;
+        int* cont = row_cont;
+        char shadow_buf[ FZ_SHADOW_SIZE(MAX_PATH_LEN) ];
+        char* shadow = shadow_buf;
+        if(len > MAX_PATH_LEN && grow_longbuf(&lb, len))
+        {
+            row = lb.row;
+            cont = lb.cont;
+            shadow = lb.shadow;
+        }
+        else if(len > MAX_PATH_LEN)
+            len = MAX_PATH_LEN;
+        if(list->_flags[ent] & FZ_ENTRY_LINE)
+        {
+            lower = shadow;
+            bonus = (unsigned char*) shadow + len;
+            make_shadow(name, len, lower, bonus);
+        }
+        int ret = fuzzy_score_only(
+                    sc, row, cont, pat, lower, bonus, len, &score);
+
+        if(out_scores == NULL)
+            list->scores[ent] = score;
+        else if(ret)
+            out_scores[cnt] = score;
+
+        /* 성공한 것들만 후보에 올린다. */
+        if(ret)
+            out[cnt++] = ent;
+    }
+#ifdef FZ_SIMD
+    if(group_cnt > 0)
+        cnt += score_group(sc, fn, lanes, list, pat, group, group_cnt,
+                                   &out[cnt], out_scores ? &out_scores[cnt] : NULL);
+#endif
+    free(lb.row);
+    free(lb.cont);
+    free(lb.shadow);
+    if(st != NULL)
+    {
+        __sync_fetch_and_add(&st->scored, scored);
+        __sync_fetch_and_add(&st->rejects, rejects);
+        __sync_fetch_and_add(&st->dp_calls, dp_calls);
+        __sync_fetch_and_add(&st->cells, cells);
+    }
+    return cnt;
+}
+
+typedef struct fz_score_job_st
+{
+    fz_scorer_t* sc;
+    fscore_list_t* list;
+    uint32_t* src;
+    int   src_from;
+    int   src_cnt;
+    uint32_t* out;
+    int*  out_scores;
+    char* pat;
+    uint64_t patsig;
+    fz_stats_t* st;
+    fscore_list_t* cancel;  /* 중단 확인할 list (호출 스레드만 확인), NULL 이면 끝까지 */
+    int   aborted;          /* 중단됨, 워커는 다음 조각을 가져가지 않는다. */
+    int   chunk_cnt;
+    int   next_chunk;  /* 다음에 가져갈 조각번호 */
+    int*  chunk_cands; /* 조각별 후보 개수 */
+} fz_score_job_t;
+
+/* 중단 요청 확인 (list 의 cancel 함수는 호출 스레드에서만 부른다.) */
+static int is_cancelled(fscore_list_t* list)
+{
+    return list != NULL && list->_cancel != NULL && list->_cancel(list->_cancel_arg);
+}
+
+static void score_job(fz_worker_t* worker, void* arg)
+{
+    fz_score_job_t* job = (fz_score_job_t*) arg;
+    int chunk;
+
+    while((chunk = __sync_fetch_and_add(&job->next_chunk, 1)) < job->chunk_cnt)
+    {
+        /* workers[0] 은 run_pool 을 부른 스레드 */
+        if(worker == &g_pool.workers[0] && is_cancelled(job->cancel))
+            job->aborted = 1;
+        if(job->aborted)
+            break;
+        int from = chunk * FZ_CHUNK_SIZE;
+        int to   = from + FZ_CHUNK_SIZE;
+        if(to > job->src_cnt)
+            to = job->src_cnt;
+
+        job->chunk_cands[chunk] = score_range(
+                    job->sc, worker->_row, worker->_row_cont, worker->_lanes,
+                    job->list, job->src, job->pat, job->patsig,
+                    job->src_from + from, job->src_from + to,
+                    &(job->out[from]), job->out_scores ? &(job->out_scores[from]) : NULL, job->st);
+    }
+}
+
+static int score_parallel( fz_score_job_t* job )
+{
+    job->chunk_cnt = (job->src_cnt + FZ_CHUNK_SIZE - 1) / FZ_CHUNK_SIZE;
+    job->next_chunk = 0;
+    job->chunk_cands = (int*) malloc (sizeof(int) * job->chunk_cnt);
+    if(job->chunk_cands == NULL)
+        return -1;
+    /* 다른 스레드가 사용중 */
+    if(pthread_mutex_trylock(&g_pool.run_lock) != 0)
+    {
+        free(job->chunk_cands);
+        return -1;
+    }
+
+    run_pool(score_job, job);
+    pthread_mutex_unlock(&g_pool.run_lock);
+    if(job->aborted)
+    {
+        free(job->chunk_cands);
+        return -1;
+    }
+
+    /* 조각별 후보를 앞으로 당겨서 합친다. */
+    uint32_t* cands = job->out;
+    int cnt = 0;
+    for(int i=0; i < job->chunk_cnt; i++)
+    {
+        if(cnt != i * FZ_CHUNK_SIZE)
+        {
+            memmove(&cands[cnt], &cands[i * FZ_CHUNK_SIZE],
+                    sizeof(uint32_t) * job->chunk_cands[i]);
+            if(job->out_scores)
+                memmove(&job->out_scores[cnt], &job->out_scores[i * FZ_CHUNK_SIZE],
+                        sizeof(int) * job->chunk_cands[i]);
+        }
+        cnt += job->chunk_cands[i];
+    }
+    free(job->chunk_cands);
+    return cnt;
+}
+
+/*
+    파일명 인덱스 src[from, from+cnt) 의 퍼지점수를 구해서 성공한 것을 out 부터 기록
+    src 가 NULL 이면 파일명 [from, from+cnt) 가 대상
+    out_scores 가 NULL 이면 점수는 list->scores 에 기록 (score_range 참고)
+    out 에 cnt 개 공간이 있어야 한다. 기록된 후보 개수 반환
+    cancel 이 있으면 조각마다 중단 요청을 확인하고, 중단되면 -1 (out 은 일부만 기록됨)
+*/
+static int score_entries( fz_scorer_t* sc, fscore_list_t* list, uint32_t* src, int from, int cnt,
+                          char* pat, uint64_t patsig, uint32_t* out, int* out_scores, fz_stats_t* st,
+                          fscore_list_t* cancel )
+{
+    if(sc->_matrix == NULL)
+        return 0;
+
+    if( cnt >= FZ_PARALLEL_MIN && init_pool() > 1 )
+    {
+        fz_score_job_t job;
+        job.sc = sc;
+        job.list = list;
+        job.src = src;
+        job.src_from = from;
+        job.src_cnt = cnt;
+        job.out = out;
+        job.out_scores = out_scores;
+        job.pat = pat;
+        job.patsig = patsig;
+        job.st = st;
+        job.cancel = cancel;
+        job.aborted = 0;
+
+        int ret = score_parallel(&job);
+        if(ret >= 0 || job.aborted)
+            return ret;
+    }
+
+    /* 점수만 계산하므로 matrix/cont 버퍼를 한 행 버퍼로 사용 */
+    if(cancel == NULL || cancel->_cancel == NULL)
+        return score_range(
+                    sc, sc->_matrix, sc->_cont, sc->_lanes,
+                    list, src, pat, patsig,
+                    from, from + cnt, out, out_scores, st);
+
+    /* 중단 확인은 조각 단위로 */
+    int found = 0;
+    for(int i=0; i < cnt; i += FZ_CHUNK_SIZE)
+    {
+        if(is_cancelled(cancel))
+            return -1;
+        int to = i + FZ_CHUNK_SIZE < cnt ? i + FZ_CHUNK_SIZE : cnt;
+        found += score_range(
+                    sc, sc->_matrix, sc->_cont, sc->_lanes,
+                    list, src, pat, patsig,
+                    from + i, from + to, &out[found], out_scores ? &out_scores[found] : NULL, st);
+    }
+    return found;
+}
+
+/* list 의 스코어러로 계산해서 list->cands[out] 부터 기록, cancellable 이면 중단될 수 있다. (-1) */
+static int score_candidates( fscore_list_t* list, uint32_t* src, int from, int cnt,
+                             char* pat, uint64_t patsig, int out, int cancellable )
+{
+    return score_entries(&list->_scorer, list, src, from, cnt, pat, patsig,
+                         &(list->cands[out]), NULL, LIST_STATS(list), cancellable ? list : NULL);
+}
+
+
+/*
+    점진 검색용 후보 스택
+
+    - 패턴에 글자가 추가되면 결과는 직전 후보의 부분집합이므로 직전 후보만 다시 계산
+    - 패턴별(list->_level_pat 의 앞부분) 후보와 점수를 부분정렬 상태 그대로 스택으로 보관
+    - 백스페이스 등으로 패턴이 줄면 스택에서 같은 패턴의 후보를 그대로 복원
+    - 저장 후 추가된 파일명(백그라운드 로드)은 단계별 len 이후만 따로 계산
+    - 빈 패턴(전체 목록)은 스택에 두지 않는다.
+*/
+static void push_level(fscore_list_t* list, int patlen)
+{
+    fz_level_t* lv = &(list->_levels[list->_level_cnt]);
+
+    if(lv->cap < list->cands_cnt)
+    {
+        uint32_t* cands = (uint32_t*) realloc (lv->cands, sizeof(uint32_t) * list->cands_cnt);
+        int* scores = (int*) realloc (lv->scores, sizeof(int) * list->cands_cnt);
+        if(cands)
+            lv->cands = cands;
+        if(scores)
+            lv->scores = scores;
+        if(cands == NULL || scores == NULL)
+            return; /* 저장하지 못하면 다음에 다시 계산한다. */
+        lv->cap = list->cands_cnt;
+    }
+    lv->patlen = patlen;
+    lv->len = list->len;
+    lv->cnt = list->cands_cnt;
+    lv->ordered = list->_ordered;
+    lv->heaped = list->_heaped;
+    if(lv->cnt > 0)
+        memcpy(lv->cands, list->cands, sizeof(uint32_t) * lv->cnt);
+    for(int i=0; i < lv->cnt; i++)
+        lv->scores[i] = list->scores[list->cands[i]];
+    list->_level_cnt++;
+}
+
+/* 현재 패턴의 단계를 다시 저장 (스택 맨 위가 현재 패턴이어야 함) */
+static void update_top_level(fscore_list_t* list, int patlen)
+{
+    if(list->_level_cnt > 0 && list->_levels[list->_level_cnt - 1].patlen == patlen)
+        list->_level_cnt--;
+    push_level(list, patlen);
+}
+
+/* 점진 검색 시작점의 패턴 길이 기준으로 새로 추가된 [from, len) 계산해서 후보 뒤에 붙인다. */
+static void score_new_entries(fscore_list_t* list, int from)
+{
+    char* pat = list->_level_pat;
+    int cnt = score_candidates(list, NULL, from, list->len - from,
+                               pat, get_char_sig(pat, strlen(pat)), list->cands_cnt, 0);
+    list->cands_cnt += cnt;
+}
+
+static void restore_level(fscore_list_t* list, fz_level_t* lv)
+{
+    if(lv->cnt > 0)
+        memcpy(list->cands, lv->cands, sizeof(uint32_t) * lv->cnt);
+    for(int i=0; i < lv->cnt; i++)
+        list->scores[list->cands[i]] = lv->scores[i];
+    list->cands_cnt = lv->cnt;
+    list->_ordered = lv->ordered;
+    list->_heaped = lv->heaped;
+
+    /* 저장 후에 추가된 파일명 */
+    if(lv->len < list->len)
+    {
+        score_new_entries(list, lv->len);
+        order_new_candidates(list);
+        update_top_level(list, lv->patlen);
+    }
+}
+
+/* 빈 패턴은 전체가 후보, 처음 로드한 순서대로 */
+static void set_all_candidates(fscore_list_t* list)
+{
+    int cnt = 0;
+    for(int i=0; i < list->len; i++)
+    {
+        if(list->_flags[i] & FZ_ENTRY_DELETED)
+            continue;
+        list->scores[i] = -i;
+        list->cands[cnt++] = i;
+    }
+    list->cands_cnt = cnt;
+    order_new_candidates(list);
+}
+
+
+static int update_candidates ( fscore_list_t* list , char* pat )
+{
+    char patbuf[MAX_PATTERN + 1];
+    int patlen = strlen(pat);
+
+    /* 계산용 버퍼 크기를 넘는 패턴은 잘라서 사용 */
+    if(patlen > MAX_PATTERN)
+    {
+        patlen = MAX_PATTERN;
+        memcpy(patbuf, pat, patlen);
+        patbuf[patlen] = '\0';
+        pat = patbuf;
+    }
+    uint64_t patsig = get_char_sig(pat, strlen(pat));
+
+    /* 이번 갱신 통계 (정렬 시간은 fz_order_candidates 에서 더한다.) */
+    if(g_stats_on)
+    {
+        list->stats.updates++;
+        list->stats.last_scored = 0;
+        list->stats.last_score_ns = 0;
+        list->stats.last_sort_ns = 0;
+    }
+
+    /* 새 패턴의 앞부분이 아닌 단계는 버린다. */
+    int common = 0;
+    while(common < patlen && list->_level_pat[common] == pat[common])
+        common++;
+    while(list->_level_cnt > 0 && list->_levels[list->_level_cnt - 1].patlen > common)
+        list->_level_cnt--;
+    memcpy(list->_level_pat, pat, patlen);
+    list->_level_pat[patlen] = '\0';
+
+    fz_level_t* base = list->_level_cnt > 0 ? &(list->_levels[list->_level_cnt - 1]) : NULL;
+
+    /* 같은 패턴으로 계산해 둔 것이 있으면 그대로 복원 (정렬 상태까지 복원됨) */
+    if(base != NULL && base->patlen == patlen)
+    {
+        restore_level(list, base);
+        return 1;
+    }
+
+    if(patlen == 0)
+    {
+        set_all_candidates(list);
+        return 1;
+    }
+
+    uint64_t t0 = g_stats_on ? now_ns() : 0;
+    uint64_t scored0 = list->stats.scored;
+
+    /* 직전 단계의 후보만 다시 계산한다. */
+    int cnt;
+    if(base != NULL)
+        cnt = score_candidates(list, base->cands, 0, base->cnt, pat, patsig, 0, 1);
+    else
+        cnt = score_candidates(list, NULL, 0, list->len, pat, patsig, 0, 1);
+
+    if(cnt < 0)
+    {
+        /* 중단: 마지막으로 완료된 단계(패턴 앞부분)로 되돌린다. 이 패턴은 다음 호출에서 다시 계산 */
+        list->_level_pat[base != NULL ? base->patlen : 0] = '\0';
+        if(base != NULL)
+            restore_level(list, base);
+        else
+            set_all_candidates(list);
+        if(g_stats_on)
+        {
+            list->stats.cancels++;
+            list->stats.last_scored = list->stats.scored - scored0;
+            list->stats.last_score_ns = now_ns() - t0;
+            list->stats.score_ns += list->stats.last_score_ns;
+        }
+        return 0;
+    }
+    list->cands_cnt = cnt;
+    /* 직전 단계 저장 후 추가된 파일명 */
+    if(base != NULL && base->len < list->len)
+        score_new_entries(list, base->len);
+
+    if(g_stats_on)
+    {
+        list->stats.last_scored = list->stats.scored - scored0;
+        list->stats.last_score_ns = now_ns() - t0;
+        list->stats.score_ns += list->stats.last_score_ns;
+    }
+
+    /* 정렬  */
+    order_new_candidates(list);
+
+    push_level(list, patlen);
+    return 1;
+}
+
+int update_candidates_by_fuzzy_score ( fscore_list_t* list , char* pat )
+{
+    int done = update_candidates(list, pat);
+
+    /* 보이는 상위 후보의 일치위치를 미리 구해 둔다. (그리기, 커서 이동은 점수 계산 없이) */
+    reset_positions(list);
+    if(!done || list->_level_pat[0] == '\0' || list->cands_topk <= 0)
+        return done;
+
+    uint64_t t0 = g_stats_on ? now_ns() : 0;
+    int cnt = list->cands_topk;
+    if(cnt > list->_ordered)
+        cnt = list->_ordered;
+    if(cnt > FZ_POS_CACHE)
+        cnt = FZ_POS_CACHE;
+    for(int i=0; i < cnt; i++)
+    {
+        uint16_t* pos;
+        fz_cand_positions(list, i, &pos);
+    }
+    if(g_stats_on)
+    {
+        uint64_t ns = now_ns() - t0;
+        list->stats.last_score_ns += ns;
+        list->stats.score_ns += ns;
+    }
+    return 1;
+}
+
+void fz_set_cancel( fscore_list_t* list, int (*cancel)(void* arg), void* arg )
+{
+    list->_cancel = cancel;
+    list->_cancel_arg = arg;
+}
+
+
+int fz_query( fz_scorer_t* sc, fscore_list_t* list, char* pat, uint32_t* idx, int* scores, int cap )
+{
+    char patbuf[MAX_PATTERN + 1];
+    int patlen = strlen(pat);
+    int cnt = 0;
+
+    if(patlen > MAX_PATTERN)
+    {
+        patlen = MAX_PATTERN;
+        memcpy(patbuf, pat, patlen);
+        patbuf[patlen] = '\0';
+        pat = patbuf;
+    }
+
+    /* 빈 패턴은 추가된 순서대로 (정렬 불필요) */
+    if(patlen == 0)
+    {
+        for(int i=0; i < list->len; i++)
+        {
+            if(list->_flags[i] & FZ_ENTRY_DELETED)
+                continue;
+            if(cnt < cap)
+            {
+                idx[cnt] = i;
+                if(scores)
+                    scores[cnt] = -i;
+            }
+            cnt++;
+        }
+        return cnt;
+    }
+
+    if(sc->_matrix == NULL)
+        return -1;
+    if(sc->_cap < list->len)
+    {
+        uint32_t* cands = (uint32_t*) realloc (sc->_cands, sizeof(uint32_t) * list->len);
+        if(cands)
+            sc->_cands = cands;
+        int* cand_scores = (int*) realloc (sc->_scores, sizeof(int) * list->len);
+        if(cand_scores)
+            sc->_scores = cand_scores;
+        if(cands == NULL || cand_scores == NULL)
+            return -1;
+        sc->_cap = list->len;
+    }
+
+    cnt = score_entries(sc, list, NULL, 0, list->len, pat, get_char_sig(pat, strlen(pat)),
+                        sc->_cands, sc->_scores, NULL, NULL);
+    if(cnt == 0)
+        return 0;
+
+    /* list->scores 대신 결과 점수로 정렬 키를 만든다. */
+    sort_item_t* items = (sort_item_t*) malloc (sizeof(sort_item_t) * cnt);
+    sort_item_t* temp  = cnt < RADIX_SORT_MIN ? NULL : (sort_item_t*) malloc (sizeof(sort_item_t) * cnt);
+    if(items == NULL)
+    {
+        free(temp);
+        return -1;
+    }
+    for(int i=0; i < cnt; i++)
+    {
+        uint32_t ent = sc->_cands[i];
+        items[i].key = ~( ((uint64_t)((uint32_t)sc->_scores[i] ^ 0x80000000u) << 32) | list->_lkeys[ent] );
+        items[i].name = ENT_NAME(list, ent);
+        items[i].idx = ent;
+    }
+    sort_item_t* sorted = sort_items(items, temp, cnt);
+    for(int i=0; i < cnt && i < cap; i++)
+    {
+        idx[i] = sorted[i].idx;
+        if(scores)
+            scores[i] = (int)((uint32_t)(~sorted[i].key >> 32) ^ 0x80000000u);
+    }
+    free(items);
+    free(temp);
+    return cnt;
+}
+
+void fz_set_list_scorer( fscore_list_t* list, fz_scorer_t* sc )
+{
+    fz_scorer_t* own = &list->_scorer;
+    own->score_match      = sc->score_match;
+    own->bonus_boundary   = sc->bonus_boundary;
+    own->bonus_no_alnum   = sc->bonus_no_alnum;
+    own->bonus_camel      = sc->bonus_camel;
+    own->bonus_continuous = sc->bonus_continuous;
+    own->penalty_ingap    = sc->penalty_ingap;
+    own->penalty_firstgap = sc->penalty_firstgap;
+
+    /* 이전 가중치로 계산한 단계, 일치위치는 쓸 수 없다. */
+    list->_level_cnt = 0;
+    list->_level_pat[0] = '\0';
+    reset_positions(list);
+}
+
+
+int fz_load_poll( fscore_list_t* list )
+{
+    fz_walker_t* w = list->_walker;
+    if(w == NULL && list->_watch == NULL)
+        return 0;
+
+    /* 완료 여부를 먼저 확인해야 마지막 batch 를 놓치지 않는다. */
+    int finished = 0;
+    if(w != NULL)
+    {
+        pthread_mutex_lock(&w->lock);
+        finished = w->finished;
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    int old_len = list->len;
+    int old_cnt = list->cands_cnt;
+    int deleted = 0;
+    int added = 0;
+
+    /* 순회 결과를 먼저, 그 다음 감시 이벤트 */
+    if(w != NULL)
+        added += drain_walker(w, list, &deleted);
+    if(finished)
+    {
+        pthread_join(w->master, NULL);
+        add_walk_stats(list, w);
+        destroy_walker(w);
+        list->_walker = NULL;
+        if(list->_watch != NULL)
+        {
+            hash_free(&list->_watch->orphans);
+            hash_free(&list->_watch->orphan_trees);
+        }
+    }
+    if(list->_watch != NULL)
+    {
+        int cnt = 0;
+        added += drain_walker(list->_watch->w, list, &cnt);
+        deleted += cnt;
+    }
+
+    if(added > 0 || deleted > 0)
+    {
+        int patlen = strlen(list->_level_pat);
+        /* 빈 패턴이면 add_list 에서 후보에 추가됨 */
+        if(patlen > 0)
+            list->cands_cnt = old_cnt;
+        if(deleted > 0)
+            drop_deleted(list);
+        if(patlen > 0)
+            score_new_entries(list, old_len);
+        order_new_candidates(list);
+        if(patlen > 0)
+            update_top_level(list, patlen);
+    }
+    if(finished)
+        save_cache(list);
+    return added > 0 || deleted > 0 || finished;
+}
+
+
+#ifdef FZ_BIN_MAIN
+/* curses 기반 바이너리 컴파일시 매크로 정의하여 빌드 */
+#include <ncurses.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#define MAX_FZ_INPUT (32)
+
+char g_ascii_code[16];
+char* control_codes[] = {
+"<NUL>", "<SOH>", "<STX>", "<ETX>", "<EOT>", "<ENQ>", 
+"<ACK>", "<BEL>", "<BS>", "<HT>", "<LF>", "<VT>", "<FF>", 
+"<CR>", "<SO>", "<SI>", "<DLE>", "<DC1>", "<DC2>", "<DC3>", 
+"<DC4>", "<NAK>", "<SYN>", "<ETB>", "<CAN>", "<EM>", "<SUB>", 
+"<ESC>", "<FS>", "<GS>", "<RS>", "<US>"
+};
+
+char* get_ascii_nm(int c)
+{
+    if(0 <= c && c < 0x20)
+    {
+        return control_codes[c];
+    }
+    else if( 0x20 <= c && c < 0x7f)
+    {
+        sprintf(g_ascii_code, "'%c'", c);
+        return g_ascii_code;
+    }
+    else if( c >= 0x7f )
+    {
+        return "<DEL>";
+    }
+    else
+        return "";
+}
+
+
+/*
+    키 입력 (tty 에서 직접 읽는다)
+
+    - keypad 를 쓰지 않으므로 getch 와 같은 바이트, 읽은 것은 buf 에 모아 두고 키 시퀀스 하나씩 꺼낸다.
+    - 위쪽 아래쪽 화살표가 동시에 눌렸을 경우 :
+        <ESC> '[' 'A' <ESC> '[' 'B'
+      ESC '[' 다음은 최종문자(0x40~0x7E) 까지, ESC 'O' 는 한 글자 더 까지가 한 시퀀스
+    - ESC 뒤에 FZ_ESC_MS 동안 아무것도 없으면 ESC 키
+*/
+#define KEY_SEQ_SIZE (8)
+#define FZ_KEYS_BUF  (256)
+#define FZ_ESC_MS    (25)
+
+typedef struct fz_keys_st
+{
+    int fd;
+    unsigned char buf[FZ_KEYS_BUF];
+    int len;
+    int pos;
+} fz_keys_t;
+
+/* 읽을 수 있는 만큼 읽는다. (fd 는 O_NONBLOCK) 입력이 끊기면 0 */
+static int read_keys(fz_keys_t* k)
+{
+    if(k->pos > 0)
+    {
+        memmove(k->buf, k->buf + k->pos, k->len - k->pos);
+        k->len -= k->pos;
+        k->pos = 0;
+    }
+    while(k->len < FZ_KEYS_BUF)
+    {
+        ssize_t n = read(k->fd, k->buf + k->len, FZ_KEYS_BUF - k->len);
+        if(n > 0)
+        {
+            k->len += n;
+            continue;
+        }
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && errno == EAGAIN)
+            break;
+        return 0;
+    }
+    return 1;
+}
+
+/* 읽어 둔 키 시퀀스 하나를 seq 에, 없으면 0 */
+static int next_key(fz_keys_t* k, int seq[])
+{
+    memset(seq, 0x00, sizeof(int) * KEY_SEQ_SIZE);
+    if(k->pos >= k->len)
+        return 0;
+
+    /* ESC 만 있으면 시퀀스의 나머지가 오는지 잠깐 기다린다. */
+    if(k->buf[k->pos] == 0x1b && k->pos + 1 == k->len)
+    {
+        struct pollfd pfd;
+        pfd.fd = k->fd;
+        pfd.events = POLLIN;
+        if(poll(&pfd, 1, FZ_ESC_MS) > 0)
+            read_keys(k);
+    }
+
+    int n = 1;
+    if(k->buf[k->pos] == 0x1b && k->pos + 1 < k->len)
+    {
+        int c = k->buf[k->pos + 1];
+        if(c == '[')
+        {
+            /* 파라미터 (0x20~0x3F) 다음 최종문자 */
+            for(n = 2; k->pos + n < k->len; n++)
+            {
+                c = k->buf[k->pos + n];
+                if(c >= 0x40 && c <= 0x7e)
+                {
+                    n++;
+                    break;
+                }
+                if(c < 0x20)
+                    break;
+            }
+        }
+        else if(c == 'O' && k->pos + 2 < k->len)
+            n = 3;
+        else if(c != 0x1b)
+            n = 2;  /* Alt + 키 */
+    }
+    for(int i=0; i < n; i++)
+    {
+        if(i < KEY_SEQ_SIZE - 1)
+            seq[i] = k->buf[k->pos + i];
+    }
+    k->pos += n;
+    return 1;
+}
+
+/*
+    이벤트 대기 (self-pipe)
+    - tty 입력, SIGWINCH (시그널 핸들러가 'w'), 백그라운드 로드/감시 (fz_set_notify, 'l')
+      를 한번에 poll, 아무 일도 없으면 CPU 를 쓰지 않는다.
+    - wait_ms 가 0 이면 기다리지 않고 이미 온 것만 확인
+*/
+#define FZ_EV_KEY     (1)
+#define FZ_EV_RESIZE  (2)
+#define FZ_EV_LOAD    (4)
+#define FZ_EV_HUP     (8)
+
+static int g_event_pipe[2] = { -1, -1 };
 
-void clear_file_list(fscore_list_t* list)
+static void on_winch(int sig)
 {
-    clear_list(list);
+    (void) sig;
+    int saved = errno;
+    ssize_t ret = write(g_event_pipe[1], "w", 1);
+    (void) ret;
+    errno = saved;
 }
 
-
-void update_candidates_by_fuzzy_score ( fscore_list_t* list , char* pat )
+static int wait_event(fz_keys_t* k, int wait_ms)
 {
-    int patlen = strlen(pat);
-    int position [MAX_PATH_LEN];
+    struct pollfd fds[2];
+    int events = 0;
 
-    list->cands_cnt = 0;
+    fds[0].fd = k->fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = g_event_pipe[0];
+    fds[1].events = POLLIN;
+    if(poll(fds, 2, wait_ms) <= 0)
+        return 0;  /* EINTR 이면 신호가 쓴 바이트를 다음에 읽는다. */
 
-    for(int i=0; i < list->len; i++)
+    if(fds[1].revents & POLLIN)
     {
-        int score = 0;
-
-        /* 이전에 실패한것은 건너뛴다. */
-        if( list->scores[i]._match < patlen )
-            continue;
-        
-        /* 여기서는 포지션을 쓰지 않으므로 초기화 등을 하지 않음 */
-        /*int ret = get_fuzzy_score(
-                    pat, list->scores[i].fname,
-                    &score, position); */             
-        int ret = get_fuzzy_score_in_list(
-                    list,
-                    pat, list->scores[i].fname,
-                    &score, position);       
-
-        list->scores[i]._match = patlen;
-        list->scores[i].score = score;
-
-        if(ret)
+        char buf[64];
+        ssize_t n;
+        while( (n = read(g_event_pipe[0], buf, sizeof(buf))) > 0 )
         {
-            /* 성공한 것들만 후보에 올린다. */
-            list->scores[i]._match = MAX_PATTERN;
-            list->cands[list->cands_cnt++] = &(list->scores[i]);
+            for(int i=0; i < n; i++)
+                events |= buf[i] == 'w' ? FZ_EV_RESIZE : FZ_EV_LOAD;
         }
     }
-
-    /* 정렬  */
-    qsort( list->cands, list->cands_cnt, sizeof(fscore_t*), comp_cand);
+    if(fds[0].revents & POLLIN)
+    {
+        events |= FZ_EV_KEY;
+        if(!read_keys(k))
+            events |= FZ_EV_HUP;
+    }
+    else if(fds[0].revents & (POLLHUP | POLLERR | POLLNVAL))
+        events |= FZ_EV_HUP;
+    return events;
 }
 
+/*
+    화면 갱신 (행 단위 비교)
+    - 키마다 erase 후 전부 다시 그리면 원격 터미널에서 깜빡이고 전송량이 많다.
+    - 이번 화면을 셀(문자|속성) 배열에 그리고, 직전 화면과 다른 행의 바뀐 구간만
+      같은 속성끼리 묶어서 출력한다.
+    - 크기가 바뀌었을 때만 전체를 다시 그린다.
+*/
+typedef struct fz_frame_st
+{
+    int rows;
+    int cols;
+    chtype* cur;   /* 이번 화면 */
+    chtype* prev;  /* 직전에 출력한 화면 */
+    int full;      /* 다음 frame_flush 에서 전체 다시 그림 */
+} fz_frame_t;
 
-#ifdef FZ_BIN_MAIN
-/* curses 기반 바이너리 컴파일시 매크로 정의하여 빌드 */
-#include <ncurses.h>
-#define MAX_FZ_INPUT (32)
+static int frame_resize(fz_frame_t* fr, int rows, int cols)
+{
+    chtype* cur = (chtype*) realloc (fr->cur, sizeof(chtype) * rows * cols);
+    if(cur == NULL)
+        return 0;
+    fr->cur = cur;
+    chtype* prev = (chtype*) realloc (fr->prev, sizeof(chtype) * rows * cols);
+    if(prev == NULL)
+        return 0;
+    fr->prev = prev;
+    fr->rows = rows;
+    fr->cols = cols;
+    fr->full = 1;
+    return 1;
+}
 
-char g_ascii_code[16];
-char* control_codes[] = {
-"<NUL>", "<SOH>", "<STX>", "<ETX>", "<EOT>", "<ENQ>", 
-"<ACK>", "<BEL>", "<BS>", "<HT>", "<LF>", "<VT>", "<FF>", 
-"<CR>", "<SO>", "<SI>", "<DLE>", "<DC1>", "<DC2>", "<DC3>", 
-"<DC4>", "<NAK>", "<SYN>", "<ETB>", "<CAN>", "<EM>", "<SUB>", 
-"<ESC>", "<FS>", "<GS>", "<RS>", "<US>"
-};
+static void frame_free(fz_frame_t* fr)
+{
+    free(fr->cur);
+    free(fr->prev);
+    memset(fr, 0x00, sizeof(fz_frame_t));
+}
 
-char* get_ascii_nm(int c)
+static void frame_clear(fz_frame_t* fr)
 {
-    if(0 <= c && c < 0x20)
-    {
-        return control_codes[c];
-    }
-    else if( 0x20 <= c && c < 0x7f)
-    {
-        sprintf(g_ascii_code, "'%c'", c);
-        return g_ascii_code;
-    }
-    else if( c >= 0x7f )
+    for(int i=0; i < fr->rows * fr->cols; i++)
+        fr->cur[i] = ' ';
+}
+
+/* row 행 col 칸부터 txt 를 attr 로 쓰고 다음 칸 반환 (화면 밖은 잘림) */
+static int frame_put(fz_frame_t* fr, int row, int col, const char* txt, int len, chtype attr)
+{
+    if(row < 0 || row >= fr->rows)
+        return col;
+    /* 마지막 행의 마지막 칸은 쓰면 스크롤될 수 있으므로 비워 둔다. */
+    int end = row == fr->rows - 1 ? fr->cols - 1 : fr->cols;
+    chtype* line = &(fr->cur[row * fr->cols]);
+    for(int i=0; i < len && col < end; i++, col++)
     {
-        return "<DEL>";
+        unsigned char c = (unsigned char) txt[i];
+        if(c < 0x20 || c == 0x7f)
+            c = '?';
+        if(col >= 0)
+            line[col] = c | attr;
     }
-    else
-        return "";
+    return col;
 }
 
+static int frame_puts(fz_frame_t* fr, int row, int col, const char* txt, chtype attr)
+{
+    return frame_put(fr, row, col, txt, strlen(txt), attr);
+}
 
-/*
-    Get key-sequence in raw mode
-
-    위쪽 아래쪽 화살표가 동시에 눌렸을 경우 : 
-First:
-        <ESC> '[' 'A' <ESC> '[' 'B'
-          *  ------>
-    - 키 입력을 대기하다가 모든 키 시퀀스를 kbuf에 저장
-    - 첫번째 키 시퀀스를 seq에 저장
-
-Seconds:
-        <ESC> '[' 'A' <ESC> '[' 'B'
-                        *  ------>
-    - 두번째 키 시퀀스를 seq 저장
-*/
-#define KEY_SEQ_SIZE (8)
-
-static int raw_keys(int kbuf[], int buflen, int* buf_idx, int* err_cnt, int seq[])
+/* 바뀐 행만 출력, 행 안에서도 처음/마지막으로 바뀐 칸 사이만 같은 속성끼리 묶어서 */
+static void frame_flush(fz_frame_t* fr)
 {
-    if( kbuf[*buf_idx] == 0)
+    char span[fr->cols + 1];
+
+    for(int row=0; row < fr->rows; row++)
     {
-        int key, cnt=0;
-        *buf_idx = 0;
-        memset(kbuf, 0x00, sizeof(int) * buflen);
-        key = getch();
-        while(key == ERR)
-        {  /* meaningless ERR key skip , found it old unix */
-            cnt++; key = getch();
-            *err_cnt = cnt;
-            if(cnt > 128)
-                usleep(50 * 1000);
+        chtype* cur = &(fr->cur[row * fr->cols]);
+        chtype* prev = &(fr->prev[row * fr->cols]);
+        int first = 0;
+        int last = fr->cols - 1;
+        if(!fr->full)
+        {
+            while(first <= last && cur[first] == prev[first])
+                first++;
+            if(first > last)
+                continue;
+            while(cur[last] == prev[last])
+                last--;
         }
-        kbuf[0] = key;
-        if(key == 0x1b) /* ESC */
+        /* 끝의 공백은 clrtoeol 로 */
+        int clear = 0;
+        if(last == fr->cols - 1)
         {
-            timeout(0); /* non-blocking */
-            for(int i= 1 ; i < buflen; i++)
-            {
-                key = getch();
-                if(i == 1 && key == ERR)
-                    return 0; /* ESC KEY */
-                if(key == ERR)
-                    break;
-                kbuf[i] = key;
-            }
-            timeout(-1); /* blocking */
-        }        
-    }
-
-    int is_esc = 0;
-    int seq_idx = 0;
-    memset(seq, 0x00, sizeof(int) * KEY_SEQ_SIZE);
+            while(last >= first && cur[last] == ' ')
+                last--;
+            clear = 1;
+        }
 
-    for(int i= *buf_idx; i < buflen && kbuf[i] != 0; i++)
-    {
-        if(is_esc)
+        for(int col = first; col <= last; )
         {
-            if( kbuf[i] == 0x1b )  /* ESC :   ESC [ A  (here) ESC  */
-                break;
-            seq[seq_idx++] = kbuf[i];
-            if( kbuf[i] == 0x7e )  /* ~   :   ESC [ 1 5 ~  (here) */
-                break;
+            chtype attr = cur[col] & A_ATTRIBUTES;
+            int n = 0;
+            int start = col;
+            while(col <= last && (cur[col] & A_ATTRIBUTES) == attr)
+                span[n++] = (char) (cur[col++] & A_CHARTEXT);
+            attrset(attr);
+            mvaddnstr(row, start, span, n);
         }
-        else
+        attrset(A_NORMAL);
+        if(clear && last + 1 < fr->cols)
         {
-            seq[seq_idx++] = kbuf[i];
-            if( kbuf[i] == 0x1b ) /* ESC :  start escape sequence */
-                is_esc = 1;
-            else
-                break;
+            move(row, last + 1);
+            clrtoeol();
         }
     }
-    
-    if(seq[0] == 0x1b)
-        *buf_idx  += seq_idx + 1;
-    else
-        *buf_idx += 1;
-    
-    return 1;
+    memcpy(fr->prev, fr->cur, sizeof(chtype) * fr->rows * fr->cols);
+    fr->full = 0;
+}
+
+/* 아직 처리하지 않은 입력이 있는지 (fz_set_cancel 로 등록, 후보 갱신 중에 호출됨) */
+static int input_pending(void* arg)
+{
+    fz_keys_t* k = (fz_keys_t*) arg;
+    if(k->pos < k->len)
+        return 1;
+
+    struct pollfd pfd;
+    pfd.fd = k->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
 }
 
-static void draw_title(fscore_list_t* list, char* env_nm, char base_paths[][512], int path_idx, int path_cnt)
+static void draw_title(fz_frame_t* fr, fscore_list_t* list, char* env_nm, char base_paths[][512], int path_idx, int path_cnt)
 {
-    attron(COLOR_PAIR(2));
-    mvprintw(0, 0, "  FZC, ESC:exit [%d/%d] [Mem:%d] BasePath(%s): %s%s %s%s %s%s %s%s ", 
-        list->cands_cnt, list->len , list->_alloc_size, env_nm, 
+    char loading[64] = "";
+    char buf[4096];
+    /* 백그라운드 로드 중이면 진행상황 표시 */
+    if(fz_load_busy(list))
+        sprintf(loading, " [Idx:%d scanning...]", fz_load_found(list));
+
+    snprintf(buf, sizeof(buf), "  FZC, ESC:exit [%d/%d]%s [Mem:%lu] BasePath(%s): %s%s %s%s %s%s %s%s ", 
+        list->cands_cnt, list->len - list->_dead, loading, (unsigned long) list->_alloc_size, env_nm, 
         path_idx == 0? "*1:": " 1:",
         base_paths[0],
         path_idx == 1? "*2:": path_cnt > 1? " 2:": "",
@@ -629,62 +4367,61 @@ static void draw_title(fscore_list_t* list, char* env_nm, char base_paths[][512]
         path_idx == 3? "*4:": path_cnt > 3? " 4:": "",
         path_cnt > 3? base_paths[3]: ""
     );
-    attroff(COLOR_PAIR(2));
+    frame_puts(fr, 0, 0, buf, COLOR_PAIR(2));
 }
 
-static void draw_input(char* txt, int len)
+static void draw_input(fz_frame_t* fr, char* txt, int len)
 {
-    mvaddstr( 2, 1, "fz> ");
-    mvaddstr( 2, 5, txt);
-    attron(COLOR_PAIR(2));
-    mvaddstr( 2, 5+len, " "); /* 커서 흉내 */
-    attroff(COLOR_PAIR(2));
+    frame_puts(fr, 2, 1, "fz> ", A_NORMAL);
+    frame_puts(fr, 2, 5, txt, A_NORMAL);
+    frame_puts(fr, 2, 5+len, " ", COLOR_PAIR(2)); /* 커서 흉내 */
 }
 
-/* 퍼지를 다시 돌려서 패턴일치 위치를 색으로 표시 */
-static void draw_fname(int select, int row, char* pat, char* txt)
+/* 캐시된 패턴일치 위치를 색으로 표시 (점수 계산 없음), 일치 구간은 한번에 */
+static void draw_fname(fz_frame_t* fr, int row, fscore_list_t* list, int cand)
 {
-    int score = 0;
-    int position[MAX_PATH_LEN] = {0};
-    get_fuzzy_score(pat, txt, &score, position);
+    char* txt = fz_cand_name(list, cand);
+    uint16_t* pos = NULL;
+    int cnt = fz_cand_positions(list, cand, &pos);
+    int len = strlen(txt);
+    int col = 0;
 
-    for(int i=0; txt[i] != '\0'; i++)
-    {        
-        if(position[i] == 1)
-        {
-            attron(COLOR_PAIR(3));
-            mvaddch(row, 4+i, txt[i]);
-            attroff(COLOR_PAIR(3));
-        }
-        else
-        {
-            mvaddch(row, 4+i, txt[i]);
-        }        
+    for(int k=0; k < cnt; )
+    {
+        int start = pos[k];
+        int end = start + 1;
+        for(k++; k < cnt && pos[k] == end; k++)
+            end++;
+        frame_put(fr, row, 4+col, txt+col, start-col, A_NORMAL);
+        frame_put(fr, row, 4+start, txt+start, end-start, COLOR_PAIR(3));
+        col = end;
     }
+    if(col < len)
+        frame_put(fr, row, 4+col, txt+col, len-col, A_NORMAL);
 }
 
-/* 선택 표출 */
-static void draw_flist(int select, int maxrow, char* pat, fscore_list_t* list)
+/*
+    선택 표출, 후보 [top, top + 보이는 줄 수) 만 그린다.
+    - 보이는 곳까지만 정렬되어 있으면 되므로 스크롤하면 더 내려간 만큼만 힙에서 꺼내서 정렬
+    - 일치위치도 보이는 후보만 구한다. (fz_cand_positions)
+*/
+static void draw_flist(fz_frame_t* fr, int select, int top, int maxrow, fscore_list_t* list)
 {
     int base = 4;
-    for(int i=0; i < maxrow - base -1 && i < list->cands_cnt; i++)
+    int rows = maxrow - base - 1;
+    fz_order_candidates(list, top + rows);
+    for(int i=0; i < rows && top + i < list->cands_cnt; i++)
     {
-        if(select == i)
-        {
-            attron(COLOR_PAIR(1));
-            mvaddstr( base+i, 1, "=>");
-            attroff(COLOR_PAIR(1));
-            draw_fname(1, base+i, pat, list->cands[i]->fname);
-        }
+        if(select == top + i)
+            frame_puts(fr, base+i, 1, "=>", COLOR_PAIR(1));
         else
-        {
-            mvaddstr( base+i, 1, "- ");
-            draw_fname(0, base+i, pat, list->cands[i]->fname);
-        }
+            frame_puts(fr, base+i, 1, "- ", A_NORMAL);
+        draw_fname(fr, base+i, list, top + i);
     }
 }
 
-static void draw_keyseq(int seqs[], int maxrow)
+/* 키 입력 표시, 표시한 다음 칸 반환 */
+static int draw_keyseq(fz_frame_t* fr, int seqs[], int maxrow)
 {
     char buf[256];
     strcpy(buf, "Key input: ");
@@ -692,29 +4429,148 @@ static void draw_keyseq(int seqs[], int maxrow)
     {
         strcat( buf, get_ascii_nm(seqs[i]));
     }
-    mvaddstr(maxrow-1, 1, buf);
+    return frame_puts(fr, maxrow-1, 1, buf, A_NORMAL);
+}
+
+
+/*
+    동작 통계 (-t 로 화면 표시, FZ_STATS=path 면 끝날때 JSON 으로 기록)
+    - 점수 계산/정렬/순회 통계는 fscore_list_t.stats, 화면 갱신은 여기서 센다.
+*/
+typedef struct fz_ui_stats_st
+{
+    uint64_t keys;         /* 입력 처리 횟수 */
+    uint64_t draws;        /* 화면 갱신 횟수 */
+    uint64_t draw_ns;      /* 화면 갱신 시간 합 */
+    uint64_t draw_max_ns;
+    uint64_t last_draw_ns; /* 직전 화면 갱신 시간 */
+} fz_ui_stats_t;
+
+static fz_ui_stats_t g_ui_stats;
+static int   g_show_stats = 0;
+static char* g_stats_path = NULL;
+
+/* 키 입력 옆에 직전 입력의 통계 한 줄 */
+static void draw_stats(fz_frame_t* fr, fscore_list_t* list, int row, int col)
+{
+    fz_stats_t* st = &list->stats;
+    char buf[256];
+
+    snprintf(buf, sizeof(buf),
+        " | key: scored %llu score %.2f sort %.2f draw %.2f ms | total: rej %llu dp %llu cells %llu | walk: %llu dirs %llu files",
+        (unsigned long long) st->last_scored,
+        st->last_score_ns / 1e6, st->last_sort_ns / 1e6, g_ui_stats.last_draw_ns / 1e6,
+        (unsigned long long) st->rejects, (unsigned long long) st->dp_calls, (unsigned long long) st->cells,
+        (unsigned long long) st->dirs, (unsigned long long) st->files);
+    frame_puts(fr, row, col, buf, A_NORMAL);
+}
+
+/* JSON 문자열로 출력 (경로에 들어갈 수 있는 따옴표, 제어문자 처리) */
+static void put_json_str(FILE* fp, char* txt)
+{
+    fputc('"', fp);
+    for(unsigned char* p = (unsigned char*) txt; *p != '\0'; p++)
+    {
+        if(*p == '"' || *p == '\\')
+            fprintf(fp, "\\%c", *p);
+        else if(*p < 0x20)
+            fprintf(fp, "\\u%04x", *p);
+        else
+            fputc(*p, fp);
+    }
+    fputc('"', fp);
+}
+
+/* FZ_STATS 경로에 통계 기록 (한번 실행에 한 객체) */
+static void dump_stats(fscore_list_t* lists, char** names, int cnt)
+{
+    if(g_stats_path == NULL)
+        return;
+    FILE* fp = fopen(g_stats_path, "w");
+    if(fp == NULL)
+    {
+        fprintf(stderr, "fz: %s: %s\n", g_stats_path, strerror(errno));
+        return;
+    }
+
+    fprintf(fp, "{\"lists\":[");
+    for(int i=0; i < cnt; i++)
+    {
+        fz_stats_t* st = &lists[i].stats;
+        fprintf(fp, "%s\n {\"path\":", i > 0 ? "," : "");
+        put_json_str(fp, names[i]);
+        fprintf(fp, ",\"entries\":%d,\"dirs\":%llu,\"files\":%llu,\"walk_ms\":%.3f,"
+                    "\"updates\":%llu,\"cancels\":%llu,\"scored\":%llu,\"rejects\":%llu,\"dp_calls\":%llu,"
+                    "\"cells\":%llu,\"score_ms\":%.3f,\"sort_ms\":%.3f}",
+                lists[i].len - lists[i]._dead,
+                (unsigned long long) st->dirs, (unsigned long long) st->files, st->walk_ns / 1e6,
+                (unsigned long long) st->updates, (unsigned long long) st->cancels,
+                (unsigned long long) st->scored,
+                (unsigned long long) st->rejects, (unsigned long long) st->dp_calls,
+                (unsigned long long) st->cells, st->score_ns / 1e6, st->sort_ns / 1e6);
+    }
+    fprintf(fp, "],\n \"ui\":{\"keys\":%llu,\"draws\":%llu,\"draw_ms\":%.3f,\"draw_max_ms\":%.3f}}\n",
+            (unsigned long long) g_ui_stats.keys, (unsigned long long) g_ui_stats.draws,
+            g_ui_stats.draw_ns / 1e6, g_ui_stats.draw_max_ns / 1e6);
+    fclose(fp);
 }
 
 
-static void curses_main(char base_paths[][512], int curr_idx, int path_cnt, char* env_nm, int isfile)
+static void curses_main(char base_paths[][512], int curr_idx, int path_cnt, char* env_nm, int isfile, char* listfile)
 {
     int maxrow=0; int maxcol = 0;
-    int kbufs[64] ={0};
-    int kbuf_idx = 0;
-    int err_cnt = 0;
     int seqs[KEY_SEQ_SIZE] = {0};
+    int last_seqs[KEY_SEQ_SIZE] = {0};  /* 화면에 표시할 마지막 키 */
+    fz_frame_t frame;
+    memset(&frame, 0x00, sizeof(frame));
 
     fscore_list_t lists[4] ;
     memset(&lists, 0x00, sizeof(fscore_list_t) * 4);
 
-    for(int i=0; i < path_cnt; i++)
-        load_file_list(&lists[i], base_paths[i], isfile);
+    /* 키 입력은 출력과 따로 non-blocking 으로 연다. (출력 fd 는 blocking 으로 두어야 한다.) */
+    fz_keys_t keys;
+    memset(&keys, 0x00, sizeof(keys));
+    keys.fd = open("/dev/tty", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(keys.fd < 0 || pipe(g_event_pipe) != 0)
+    {
+        fprintf(stderr, "fz: /dev/tty: %s\n", strerror(errno));
+        if(keys.fd >= 0)
+            close(keys.fd);
+        return;
+    }
+    for(int i=0; i < 2; i++)
+        fcntl(g_event_pipe[i], F_SETFL, fcntl(g_event_pipe[i], F_GETFL) | O_NONBLOCK);
+    fz_set_notify(g_event_pipe[1]);
 
+    /* 화면을 먼저 띄우고 파일명은 백그라운드로 읽는다. */
+    /* 목록 파일은 개행만 훑으면 되므로 바로 읽는다. */
+    if(listfile != NULL)
+    {
+        if(!fz_map_list_file(&lists[0], listfile))
+        {
+            fprintf(stderr, "fz: %s: %s\n", listfile, strerror(errno));
+            clear_list(&lists[0]);
+            close(keys.fd);
+            return;
+        }
+    }
+    else
+    {
+        for(int i=0; i < path_cnt; i++)
+            fz_load_start(&lists[i], base_paths[i], isfile);
+    }
 
     /* 표준출력을 사용하기 위해 initscr 대신 신규tty 터미널 생성 */
     FILE *f = fopen("/dev/tty", "rb+");
     SCREEN *screen = newterm(NULL, f, f);
     set_term(screen);
+    /* curses 의 SIGWINCH 처리 대신 이벤트로 받는다. */
+    struct sigaction sa;
+    memset(&sa, 0x00, sizeof(sa));
+    sa.sa_handler = on_winch;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &sa, NULL);
     /* color */
     start_color();
     init_pair(1, COLOR_CYAN, COLOR_WHITE);
@@ -727,21 +4583,81 @@ static void curses_main(char base_paths[][512], int curr_idx, int path_cnt, char
     noecho();
     raw();
     getmaxyx(stdscr,maxrow,maxcol);
+    /* 화면에 보이는 후보 개수만 정렬 */
+    for(int i=0; i < path_cnt; i++)
+        lists[i].cands_topk = maxrow - 4 - 1;
 
-    int select = 0; 
+    int select = 0; /* 선택한 후보 위치 (cands) */
+    int top = 0;    /* 첫 줄에 보이는 후보 위치 */
     char input_buf[ MAX_FZ_INPUT + 1 ];
     int  input_buf_cnt = 0;
     int isupdate=0; int isenter=0;
     memset(input_buf, 0x00, sizeof(input_buf));
 
-    draw_title(&lists[curr_idx], env_nm, base_paths, curr_idx, path_cnt);
-    draw_input(input_buf, input_buf_cnt);
-    draw_flist(select, maxrow, input_buf, &lists[curr_idx]);
+    int ret = frame_resize(&frame, maxrow, maxcol);
+    if(ret)
+    {
+        frame_clear(&frame);
+        draw_title(&frame, &lists[curr_idx], env_nm, base_paths, curr_idx, path_cnt);
+        draw_input(&frame, input_buf, input_buf_cnt);
+        draw_flist(&frame, select, top, maxrow, &lists[curr_idx]);
+        frame_flush(&frame);
+    }
 
-    while(raw_keys(kbufs, 64, &kbuf_idx, &err_cnt, seqs )) /* ESC key exit */
+    int events = FZ_EV_LOAD;  /* 처음에는 로드 상태부터 확인 */
+    while(ret)
     {
-        erase();
-        isupdate = 0;
+        /* 읽어 둔 키가 없으면 이벤트를 기다린다. */
+        /* 갱신할 것이 남아 있으면 (연속 입력, 중단된 계산) 기다리지 않고 밀린 입력만 확인 */
+        int key = next_key(&keys, seqs);
+        if(!key && events == 0)
+        {
+            events = wait_event(&keys, isupdate ? 0 : -1);
+            if(events & FZ_EV_HUP)
+                break;
+            key = next_key(&keys, seqs);
+        }
+        if(key && seqs[0] == 0x1b && seqs[1] == 0) /* ESC key exit */
+            break;
+
+        /* 백그라운드 로드/감시 반영 */
+        int changed = 0;
+        if(events & FZ_EV_LOAD)
+        {
+            for(int i=0; i < path_cnt; i++)
+            {
+                if(fz_load_poll(&lists[i]) && i == curr_idx)
+                    changed = 1;
+            }
+        }
+        int resized = events & FZ_EV_RESIZE;
+        events = 0;
+        if(!key && !changed && !resized && !isupdate) /* 입력도 변화도 없음 */
+            continue;
+        if(key)
+        {
+            g_ui_stats.keys++;
+            memcpy(last_seqs, seqs, sizeof(seqs));
+        }
+
+        /* 크기가 바뀌면 보이는 후보 개수를 다시 정하고 전체를 다시 그린다. */
+        struct winsize ws;
+        if(resized && ioctl(keys.fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0)
+            resizeterm(ws.ws_row, ws.ws_col);
+        int rows = 0, cols = 0;
+        getmaxyx(stdscr, rows, cols);
+        if(rows != maxrow || cols != maxcol)
+        {
+            maxrow = rows;
+            maxcol = cols;
+            if(!frame_resize(&frame, maxrow, maxcol))
+                break;
+            for(int i=0; i < path_cnt; i++)
+                lists[i].cands_topk = maxrow - 4 - 1;
+            clearok(curscr, TRUE);
+        }
+
+        int page = maxrow - 4 - 1 > 1 ? maxrow - 4 - 1 : 1;
         if(seqs[0] == 0x1b) /* ESC  */
         {
             if(seqs[1] == 0x5b)
@@ -750,14 +4666,27 @@ static void curses_main(char base_paths[][512], int curr_idx, int path_cnt, char
                     if(select > 0)
                         select--;
                 if(seqs[2] == 0x42) /* key down */
-                    if(select+1 < maxrow - 4 - 1 && select+1 < (lists[curr_idx]).cands_cnt)
+                    if(select+1 < (lists[curr_idx]).cands_cnt)
                         select++;
+                if(seqs[2] == 0x35 && seqs[3] == 0x7e) /* page up */
+                {
+                    select -= page;
+                    top -= page;
+                }
+                if(seqs[2] == 0x36 && seqs[3] == 0x7e) /* page down */
+                {
+                    select += page;
+                    top += page;
+                }
+                if(seqs[2] == 0x48 || (seqs[2] == 0x31 && seqs[3] == 0x7e)) /* home */
+                    select = 0;
                 if(seqs[2] == 0x43) /* key right */
                     if(curr_idx + 1 < path_cnt)
                     {
                         curr_idx++;
                         memset(input_buf, 0x00, input_buf_cnt);
                         input_buf_cnt = 0;
+                        select = 0;
                     }                        
                 if(seqs[2] == 0x44) /* key left */
                     if(curr_idx - 1 >= 0)
@@ -765,6 +4694,7 @@ static void curses_main(char base_paths[][512], int curr_idx, int path_cnt, char
                         curr_idx--;
                         memset(input_buf, 0x00, input_buf_cnt);
                         input_buf_cnt = 0;
+                        select = 0;
                     }
             }
         }
@@ -789,44 +4719,256 @@ static void curses_main(char base_paths[][512], int curr_idx, int path_cnt, char
                     isupdate = 1;
                 }
             }
-            else if(seqs[0] == 0x0a) /* line feed (enter) */
+            else if(seqs[0] == 0x0a || seqs[0] == 0x0d) /* line feed, carriage return (enter) */
             {
                 isenter = 1;
             }
         }
-        if(lists[curr_idx]._alloc_size == 0)
+        if(lists[curr_idx]._alloc_size == 0 && listfile == NULL)
         {
-            load_file_list(&lists[curr_idx], base_paths[curr_idx], isfile);
+            fz_load_start(&lists[curr_idx], base_paths[curr_idx], isfile);
+            lists[curr_idx].cands_topk = maxrow - 4 - 1;
         }
 
-        /* 후보갱신 */
+        /* 붙여넣기, 빠른 입력은 밀린 키를 모두 반영한 뒤 한번만 검색 */
+        if(key && isupdate && !isenter)
+            continue;
+
+        /* 후보갱신, 계산 중에 새 입력이 오면 중단하고 그 입력까지 반영해서 다시 계산 */
         if(isupdate)
-            update_candidates_by_fuzzy_score(&lists[curr_idx], input_buf);
+        {
+            fz_set_cancel(&lists[curr_idx], isenter ? NULL : input_pending, &keys);
+            if(!update_candidates_by_fuzzy_score(&lists[curr_idx], input_buf))
+                continue;
+            isupdate = 0;
+        }
+        /* 선택은 후보 안에서, 보이는 범위는 선택을 포함하고 후보 끝을 넘지 않게 */
+        int cands_cnt = lists[curr_idx].cands_cnt;
+        if(select >= cands_cnt)
+            select = cands_cnt - 1;
+        if(select < 0)
+            select = 0;
+        if(top > cands_cnt - page)
+            top = cands_cnt - page;
+        if(top < 0)
+            top = 0;
+        if(select < top)
+            top = select;
+        if(select >= top + page)
+            top = select - page + 1;
 
-        draw_title(&lists[curr_idx], env_nm, base_paths, curr_idx, path_cnt);
-        draw_input(input_buf, input_buf_cnt);
-        draw_flist(select, maxrow, input_buf, &lists[curr_idx]);
-        draw_keyseq(seqs, maxrow);
+        uint64_t t0 = g_stats_on ? now_ns() : 0;
+        frame_clear(&frame);
+        draw_title(&frame, &lists[curr_idx], env_nm, base_paths, curr_idx, path_cnt);
+        draw_input(&frame, input_buf, input_buf_cnt);
+        draw_flist(&frame, select, top, maxrow, &lists[curr_idx]);
+        int col = draw_keyseq(&frame, last_seqs, maxrow);
+        if(g_show_stats)
+            draw_stats(&frame, &lists[curr_idx], maxrow-1, col);
 
         if(isenter == 1)
         {
             break;
         }
 
+        frame_flush(&frame);
         refresh();
+        if(g_stats_on)
+        {
+            uint64_t ns = now_ns() - t0;
+            g_ui_stats.draws++;
+            g_ui_stats.draw_ns += ns;
+            g_ui_stats.last_draw_ns = ns;
+            if(ns > g_ui_stats.draw_max_ns)
+                g_ui_stats.draw_max_ns = ns;
+        }
     }
     endwin();
     delscreen(screen);
     fclose(f);
+    frame_free(&frame);
+    signal(SIGWINCH, SIG_DFL);
+    /* 알림 pipe 는 로드/감시 스레드가 아직 쓸 수 있으므로 닫지 않는다. */
+    close(keys.fd);
     /* curses end */
 
-    if(isenter == 1)
+    if(isenter == 1 && select < lists[curr_idx].cands_cnt && listfile != NULL)
+    {
+        /* 목록 파일의 줄은 그대로 출력 */
+        fprintf(stdout, "%s\n", fz_cand_name(&lists[curr_idx], select));
+    }
+    else if(isenter == 1 && select < lists[curr_idx].cands_cnt)
+    {
+        /* 절대경로로 바꾸어 출력한다. (기준경로 + 상대경로는 MAX_PATH_LEN 을 넘을 수 있으므로 바로 출력) */
+        fprintf(stdout, "%s/%s\n", base_paths[curr_idx], fz_cand_name(&lists[curr_idx], select));
+    }
+
+    char* names[4];
+    for(int i=0; i < path_cnt; i++)
+        names[i] = base_paths[i];
+    dump_stats(lists, names, path_cnt);
+}
+
+/*
+    필터 모드 (-f) : 화면 없이 stdin 의 줄들을 후보로 검색하여 상위 N 개를 stdout 으로 출력
+    $ producer | fz -f query -n 50
+    $ fz -i list.txt -f query -n 50
+
+    - stdin 은 큰 버퍼로 읽어 줄 단위로 바로 리스트에 추가 (버퍼 경계에 걸친 줄은 앞으로 옮겨서 이어 읽음)
+    - 목록 파일(-i)이 있으면 stdin 대신 fz_map_list_file 로 복사 없이 사용
+    - 점수 계산/정렬은 화면 모드와 같은 엔진 (상위 N 개만 정렬)
+    - flags : FZ_FILTER_SCORE 이면 "점수<TAB>" 를 앞에, FZ_FILTER_POS 이면 "<TAB>일치위치(0부터, 콤마구분)" 를 뒤에 붙인다.
+    - 일치하는 줄이 없으면 1, 읽기/메모리 오류는 2 를 반환 (grep 과 같은 종료코드)
+*/
+#define FZ_FILTER_SCORE  1
+#define FZ_FILTER_POS    2
+#define FZ_FILTER_BUF    (1 << 20)
+
+/* stdin 의 줄들을 list 에 추가, 읽기/메모리 오류면 0 (errno 설정) */
+static int read_stdin_list(fscore_list_t* list)
+{
+    size_t cap = FZ_FILTER_BUF;
+    size_t used = 0;
+    char* buf = (char*) malloc (cap);
+    int err = 0;
+
+    if(buf == NULL)
+        return 0;
+
+    for(;;)
+    {
+        /* 한 줄이 버퍼보다 길면 늘린다. (마지막 NUL 자리 포함) */
+        if(used + 1 >= cap)
+        {
+            char* nbuf = (char*) realloc (buf, cap * 2);
+            if(nbuf == NULL)
+            {
+                err = 1;
+                break;
+            }
+            buf = nbuf;
+            cap *= 2;
+        }
+
+        ssize_t rd = read(STDIN_FILENO, buf + used, cap - used - 1);
+        if(rd < 0 && errno == EINTR)
+            continue;
+        if(rd < 0)
+        {
+            err = 1;
+            break;
+        }
+        if(rd == 0)
+        {
+            /* 개행 없이 끝난 마지막 줄 */
+            if(used > 0 && buf[used - 1] == '\r')
+                used--;
+            if(used > 0)
+            {
+                buf[used] = '\0';
+                if(!add_list(list, buf) && used <= 0xFFFF)
+                {
+                    errno = ENOMEM;
+                    err = 1;
+                }
+            }
+            break;
+        }
+
+        size_t end = used + rd;
+        size_t start = 0;
+        char* nl;
+        while( (nl = memchr(buf + used, '\n', end - used)) != NULL )
+        {
+            size_t pos = nl - buf;
+            size_t len = pos - start;
+            if(len > 0 && buf[start + len - 1] == '\r')
+                len--;
+            buf[start + len] = '\0';
+            /* 빈 줄은 건너뜀, 65535 바이트를 넘는 줄은 add_list 가 거절 */
+            if(len > 0 && !add_list(list, buf + start) && len <= 0xFFFF)
+            {
+                errno = ENOMEM;
+                err = 1;
+                break;
+            }
+            start = pos + 1;
+            used = start;
+        }
+        if(err)
+            break;
+
+        /* 남은 (끝나지 않은) 줄은 버퍼 앞으로 */
+        used = end - start;
+        if(start > 0 && used > 0)
+            memmove(buf, buf + start, used);
+    }
+    free(buf);
+    return !err;
+}
+
+static int filter_main(char* pat, int topn, int flags, char* listfile)
+{
+    fscore_list_t list;
+
+    if(listfile != NULL)
+    {
+        if(!fz_map_list_file(&list, listfile))
+        {
+            fprintf(stderr, "fz: %s: %s\n", listfile, strerror(errno));
+            clear_list(&list);
+            return 2;
+        }
+    }
+    else
+    {
+        if(!init_list(&list) || !read_stdin_list(&list))
+        {
+            fprintf(stderr, "fz: %s\n", strerror(errno));
+            clear_list(&list);
+            return 2;
+        }
+    }
+
+    /* 계산 버퍼 크기를 넘는 패턴은 잘라서 사용 (위치 계산도 같은 패턴으로) */
+    char patbuf[MAX_PATTERN + 1];
+    snprintf(patbuf, sizeof(patbuf), "%s", pat);
+
+    list.cands_topk = topn;
+    update_candidates_by_fuzzy_score(&list, patbuf);
+
+    int cnt = list.cands_cnt;
+    if(topn > 0 && cnt > topn)
+        cnt = topn;
+    fz_order_candidates(&list, cnt);
+
+    static char outbuf[1 << 16];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+    for(int i=0; i < cnt; i++)
     {
-        /* 절대경로로 바꾸어 출력한다. */
-        char input_path[ MAX_PATH_LEN ];
-        sprintf(input_path , "%s/%s\n", base_paths[curr_idx], (lists[curr_idx]).cands[select]->fname );        
-        fprintf(stdout, "%s", input_path );
+        char* name = fz_cand_name(&list, i);
+
+        if(flags & FZ_FILTER_SCORE)
+            printf("%d\t", patbuf[0] ? fz_cand_score(&list, i) : 0);
+        fputs(name, stdout);
+        if(flags & FZ_FILTER_POS)
+        {
+            uint16_t* pos = NULL;
+            int pos_cnt = fz_cand_positions(&list, i, &pos);
+            for(int j=0; j < pos_cnt; j++)
+                printf("%c%d", j == 0 ? '\t' : ',', pos[j]);
+        }
+        putchar('\n');
     }
+    fflush(stdout);
+
+    char* name = listfile != NULL ? listfile : "-";
+    dump_stats(&list, &name, 1);
+
+    int found = list.cands_cnt;
+    clear_list(&list);
+    return found > 0 ? 0 : 1;
 }
 
 void show_usage()
@@ -834,13 +4976,29 @@ void show_usage()
     char* usage = 
         " Fuzzy file finder \n"\
         "    부분일치, 약어일치 등으로 파일을 검색합니다.\n\n"\
-        "    $ fz [-hd] [Argument]\n"\
+        "    $ fz [-hdecw] [-j threads] [Argument]\n"\
+        "    $ producer | fz -f query [-n N] [-sp]\n"\
+        "    $ fz -i listfile [-f query ...]\n"\
         "\n"\
         "    Option:\n"\
         "       -h      help\n"\
         "       -d      directory 검색모드  기본은 file 검색 \n"\
         "       -e      ENV 'FZ_BASE_PATH' 의 경로로 고정    \n"\
         "               이 옵션이 없으면 서브디렉토리 만 적용\n"\
+        "       -j N    퍼지검색 스레드 개수 (기본: FZ_THREADS 또는 CPU 개수)\n"\
+        "       -c      인덱스 캐시 사용, 바뀐 디렉토리만 다시 읽음\n"\
+        "               (위치: FZ_CACHE_DIR 또는 ~/.cache/fz)    \n"\
+        "       -w      감시 모드, 생성/삭제된 파일을 바로 반영 (linux)\n"\
+        "       -f Q    필터 모드, 화면 없이 stdin 의 줄들을 Q 로 검색하여 stdout 으로 출력\n"\
+        "       -n N    필터 모드의 출력 개수 (기본: 전부)\n"\
+        "       -s      필터 모드, 줄 앞에 점수 출력 (점수<TAB>줄)\n"\
+        "       -p      필터 모드, 줄 뒤에 일치위치 출력 (줄<TAB>0,3,7)\n"\
+        "       -i F    디렉토리 대신 목록 파일 F (한 줄에 하나) 에서 검색\n"\
+        "               파일을 mmap 해서 복사 없이 사용, -f 와 같이 쓰면 stdin 대신 사용\n"\
+        "       -t      키 입력 옆에 통계 표시 (점수계산/거절/DP/셀 개수, 계산/정렬/화면 시간)\n"\
+        "\n"\
+        "    ENV:\n"\
+        "       FZ_STATS=path  끝날때 통계를 path 에 JSON 으로 기록\n"\
         "\n"
     ;
 
@@ -853,9 +5011,14 @@ int main(int argc, char* argv[])
     int c;
     int isfile = 1;
     int isenv = 0;
+    int iscache = 0;
+    char* filter = NULL;
+    char* listfile = NULL;
+    int topn = 0;
+    int filter_flags = 0;
 
     /* option */
-    while( (c = getopt(argc, argv, "hde")) != -1)
+    while( (c = getopt(argc, argv, "hdej:cwf:n:spi:t")) != -1)
     {
         switch(c)
         {
@@ -869,6 +5032,33 @@ int main(int argc, char* argv[])
             case 'e':
                 isenv = 1;
                 break;
+            case 'j':
+                fz_set_thread_count(atoi(optarg));
+                break;
+            case 'c':
+                iscache = 1;
+                break;
+            case 'w':
+                fz_set_watch(1);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'n':
+                topn = atoi(optarg);
+                break;
+            case 's':
+                filter_flags |= FZ_FILTER_SCORE;
+                break;
+            case 'p':
+                filter_flags |= FZ_FILTER_POS;
+                break;
+            case 'i':
+                listfile = optarg;
+                break;
+            case 't':
+                g_show_stats = 1;
+                break;
             case '?':
                 printf("Unknown Flags\n");
                 show_usage();
@@ -877,12 +5067,46 @@ int main(int argc, char* argv[])
         }
     }
 
-    /* base-path  */
+    /* 통계는 켜야 센다. (꺼져 있으면 시각을 재지 않음) */
+    g_stats_path = getenv("FZ_STATS");
+    if(g_stats_path != NULL && g_stats_path[0] == '\0')
+        g_stats_path = NULL;
+    if(g_show_stats || g_stats_path != NULL)
+        fz_set_stats(1);
+
+    /* 필터 모드는 화면 없이 stdin 만 처리 */
+    if(filter != NULL)
+        return filter_main(filter, topn, filter_flags, listfile);
+
+    /* 인덱스 캐시 위치 */
     char buf[2048];
+    if(iscache)
+    {
+        char* dir = getenv("FZ_CACHE_DIR");
+        if(dir != NULL)
+            snprintf(buf, sizeof(buf), "%s", dir);
+        else if(getenv("XDG_CACHE_HOME") != NULL)
+            snprintf(buf, sizeof(buf), "%s/fz", getenv("XDG_CACHE_HOME"));
+        else if(getenv("HOME") != NULL)
+            snprintf(buf, sizeof(buf), "%s/.cache/fz", getenv("HOME"));
+        else
+            buf[0] = '\0';
+        fz_set_cache_dir(buf);
+    }
+
+    /* base-path  */
     char base_paths[4][512]; /* 4개의 PATH 허용 */
     strcpy(base_paths[0], ".");
     int base_paths_cnt = 1;
     int curr_base_path_idx = 0;
+
+    /* 목록 파일은 base-path 대신 제목에 표시 */
+    if(listfile != NULL)
+    {
+        snprintf(base_paths[0], sizeof(base_paths[0]), "%s", listfile);
+        curses_main(base_paths, 0, 1, "LIST", isfile, listfile);
+        return 0;
+    }
     
     /* 환경변수의 값으로 base 지정 */
     char* env_nm = "cwd";
@@ -934,7 +5158,7 @@ int main(int argc, char* argv[])
 
 
     
-    curses_main(base_paths, curr_base_path_idx, base_paths_cnt, env_nm, isfile);
+    curses_main(base_paths, curr_base_path_idx, base_paths_cnt, env_nm, isfile, NULL);
     
     return 0;
 }
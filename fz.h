@@ -7,61 +7,166 @@
 #ifndef __FZ_H__
 #define __FZ_H__
 
-#define MAX_FILE_NUM (262144)   /* (1024 * 1024) */
+#include <stdint.h>
+#include <stddef.h>
+
 #define MAX_PATH_LEN (512)
 #define MAX_PATTERN  (32)
 
 /**
- * @struct fscore_st
- * @brief  파일명 퍼지스코어 mapping 구조체
+ * @struct fz_scorer_st
+ * @brief  퍼지점수 계산 컨텍스트 (가중치, 계산용 버퍼)
+ * @details 스레드마다 하나씩 만들어 쓰면 fz_score, fz_query 를 동시에 호출할 수 있다.
+ *          가중치는 fz_scorer_init 후에 바꿔도 된다.
+ */
+typedef struct fz_scorer_st
+{
+    int score_match;       /* 일치한 문자 점수 */
+    int bonus_boundary;    /* 단어 시작 문자 보너스 */
+    int bonus_no_alnum;    /* 영숫자가 아닌 문자 보너스 */
+    int bonus_camel;       /* camelCase 대문자 보너스 */
+    int bonus_continuous;  /* 연속 일치 최소 보너스 */
+    int penalty_ingap;     /* 불일치가 이어질 때 감점 */
+    int penalty_firstgap;  /* 첫 불일치 감점 */
+
+    /* 내부적으로 사용되는 계산용 버퍼 */
+    char* _shadow;
+    int*  _matrix;
+    int*  _cont;
+    struct fz_lanes_st* _lanes;   /* SIMD 계산용, 지원하지 않으면 NULL */
+    uint32_t* _cands;             /* fz_query 결과 */
+    int*  _scores;
+    int   _cap;
+} fz_scorer_t;
+
+/**
+ * @struct fz_stats_st
+ * @brief  동작 통계 (fz_set_stats 로 켰을 때만 모은다)
+ * @details 순회 카운터는 로드가 끝날 때 반영된다.
+ *          시간은 나노초, last_ 는 마지막 update_candidates_by_fuzzy_score 와 그 후의 fz_order_candidates
+ */
+typedef struct fz_stats_st
+{
+    /* 순회 (load_file_list, fz_load_start) */
+    uint64_t dirs;        /* 읽은 디렉토리 */
+    uint64_t files;       /* 디렉토리에서 읽은 항목 중 디렉토리가 아닌 것 */
+    uint64_t walk_ns;
+
+    /* 퍼지점수 계산 */
+    uint64_t updates;     /* update_candidates_by_fuzzy_score 호출 */
+    uint64_t scored;      /* 점수 계산 대상 파일명 */
+    uint64_t rejects;     /* 문자 집합 사전필터로 제외된 파일명 */
+    uint64_t dp_calls;    /* DP 계산한 파일명 (SIMD 레인 포함) */
+    uint64_t cells;       /* DP 칸 수 (패턴 길이 x 파일명 길이, 일찍 끝나도 전체로 셈) */
+    uint64_t cancels;     /* 중단된 update_candidates_by_fuzzy_score (fz_set_cancel) */
+    uint64_t score_ns;
+    uint64_t sort_ns;
+
+    uint64_t last_scored;
+    uint64_t last_score_ns;
+    uint64_t last_sort_ns;
+} fz_stats_t;
+
+/* fscore_list_t::_flags, 삭제된 파일명 (재검증/감시에서 삭제 표시만 하고 자리는 유지) */
+#define FZ_ENTRY_DELETED (1)
+
+/**
+ * @struct fz_level_st
+ * @brief  점진 검색용 후보 스택의 한 단계 (내부용)
  *
- * @var fscore_t::fname
- * 	파일명
- * @var fscore_t::score
- * 	Fuzzy 점수
- * @var fscore_t::_match
- * 	Curses 구현에서 내부적으로 사용하는 값 (직전 최대 매치 패턴 길이)
- */
-typedef struct fscore_st
+ * @var fz_level_t::patlen
+ * 	이 단계의 패턴 길이, 패턴은 fscore_list_t::_level_pat 의 앞부분
+ * @var fz_level_t::cands
+ * 	후보 파일명 인덱스 (ordered 개까지 정렬, 나머지는 힙)
+ * @var fz_level_t::scores
+ * 	후보별 퍼지 점수 (더 긴 패턴에서 덮어쓰므로 따로 보관)
+ */
+typedef struct fz_level_st
 {
-    char* fname;
-    int score;
-    int _match; 
-}fscore_t;
+    int  patlen;
+    int  len;      /* 저장할 때의 fscore_list_t::len, 이후 추가된 것은 따로 계산 */
+    int  cnt;
+    int  cap;
+    int  ordered;
+    int  heaped;
+    uint32_t* cands;
+    int* scores;
+} fz_level_t;
 
 /**
  * @struct fscore_list_t
  * @brief  파일명 리스트 구조체
+ * @details 파일명별 정보는 항목별 배열(SoA)로 관리하고 파일명 인덱스(0 ~ len-1)로 접근한다.
  *
  * @var fscore_list_t::scores
- * 	원본, 파일명과 퍼지스코어 등이 관리되는 배열.
+ * 	파일명별 퍼지스코어
  * @var fscore_list_t::len
- * 	원본의 파일명 배열의 크기
+ * 	원본의 파일명 배열의 크기 (개수 제한 없음, 필요할 때 배열을 늘린다)
  * @var fscore_list_t::cands
- * 	후보, 성능을 높이기 위해 포인터의 배열 사용.
+ * 	후보, 파일명 인덱스의 배열. 파일명은 fz_get_name 이나 fz_cand_name 으로 구한다.
  * @var fscore_list_t::cands_cnt
  * 	후보의 개수
+ * @var fscore_list_t::cands_topk
+ * 	후보 갱신시 정렬할 개수, 0 이면 전부 정렬.
+ * 	화면에 보이는 개수만 지정하면 나머지는 fz_order_candidates 로 필요할 때 정렬한다.
  */
 typedef struct  fscore_list_st
 {
-    fscore_t*  scores;
+    int*       scores;
+    uint32_t*  _offs;    /* 파일명 POOL 위치 (FZ_OFF_MAPPED 이면 캐시 POOL) */
+    uint16_t*  _lens;    /* 파일명 길이 */
+    uint8_t*   _flags;   /* FZ_ENTRY_DELETED 등 */
+    uint32_t*  _lkeys;   /* 정렬 키의 하위 32비트 (길이, 파일명 앞 2바이트) */
+    uint64_t*  _sigs;    /* 파일명에 나타나는 문자 집합 비트마스크 (사전필터용) */
     int  len;
+    int  _cap;     /* 파일명별 배열/cands 할당 크기 */
 
-    fscore_t** cands; 
+    uint32_t*  cands;
     int  cands_cnt;
+    int  cands_topk;
+
+    /* cands[0, _ordered) 정렬완료, 나머지는 (_heaped 이면) 힙 */
+    int  _ordered;
+    int  _heaped;
+
+    /* 내부적으로 사용되는 파일명 POOL, 한 덩어리로 늘어나므로 32비트 위치로 가리킨다. */
+    /* _pool: [file1\0...file2\0...             ]*/
+    /*                              used       cap */
+    char*  _pool;
+    size_t _pool_used;
+    size_t _pool_cap;
+    char*  _map_pool;   /* mmap 한 캐시 파일의 POOL, 또는 목록 파일 (fz_map_list_file) */
+    size_t _map_size;   /* 목록 파일을 mmap 한 크기, 캐시면 0 */
+
+    /* 내부적으로 사용되는 퍼지스코어 계산용 스코어러 (fz_set_list_scorer 로 가중치 변경) */
+    fz_scorer_t _scorer;
+
+    /* 점진 검색용 후보 스택 */
+    fz_level_t _levels[MAX_PATTERN + 1];
+    int  _level_cnt;
+    char _level_pat[MAX_PATTERN + 1];
+
+    /* 후보 일치위치 캐시 (fz_cand_positions), 후보 위치 i 는 i % FZ_POS_CACHE 칸에 대응 */
+    struct fz_pos_st* _pos;
+    uint32_t _pos_gen;  /* 패턴/가중치가 바뀌면 증가, 칸의 gen 이 다르면 다시 구한다. */
+
+    /* 후보 갱신 중단 확인 (fz_set_cancel), 사용하지 않으면 NULL */
+    int (*_cancel)(void* arg);
+    void* _cancel_arg;
+
+    /* 백그라운드 로드 (fz_load_start) */
+    struct fz_walker_st* _walker;
+    int  _dead;   /* 삭제 표시된 파일명 개수 (len 에 포함) */
+
+    /* 인덱스 캐시 (fz_set_cache_dir), 사용하지 않으면 NULL */
+    struct fz_cache_st* _cache;
 
-    /* 내부적으로 사용되는 파일명 POOL */
-    /* [file1\0file2\0             ]*/
-    /*                *cursor       */
-    char*  _fname_pool;
-    char*  _fname_cursor;
+    /* 감시 모드 (fz_set_watch), 사용하지 않으면 NULL */
+    struct fz_watch_st* _watch;
 
-    /* 내부적으로 사용되는 퍼지스코어 계산용 버퍼 */
-    int* _bonus;
-    int* _matrix;
-    int* _cont;
+    size_t _alloc_size;   /* 실제 사용중인 메모리 (byte) */
 
-    int _alloc_size;
+    fz_stats_t stats;     /* fz_set_stats 로 켰을 때 동작 통계 */
 } fscore_list_t;
 
 /**
@@ -78,18 +183,46 @@ typedef struct  fscore_list_st
 int get_fuzzy_score                              (char* pat, char* txt, int* fscore, int position[]);
 int get_fuzzy_score_in_list( fscore_list_t* list, char* pat, char* txt, int* fscore, int position[]);
 
+/**
+ * @brief  스코어러 초기화 (기본 가중치, 계산용 버퍼 할당)
+ * @param[out] sc  초기화할 스코어러
+ * @return 성공 여부 (0 이면 메모리 부족)
+ */
+int  fz_scorer_init ( fz_scorer_t* sc );
+/**
+ * @brief  스코어러 버퍼 해제
+ */
+void fz_scorer_free ( fz_scorer_t* sc );
+/**
+ * @brief  스코어러로 Fuzzy Score 구하기 (get_fuzzy_score 와 같고 재진입 가능)
+ * @param[in,out] sc  스코어러 (버퍼를 사용하므로 스레드마다 따로)
+ * @param[in] pat  패턴문자열 (MAX_PATTERN 이하)
+ * @param[in] txt  검색문자열 (MAX_PATH_LEN 보다 길면 버퍼를 따로 잡아서 계산)
+ * @param[out] fscore  Fuzzy 점수
+ * @param[out] position  검색대상문자열에서 패턴이 일치한 위치 (strlen(txt) 칸 이상)
+ * @return 패턴 일치했는지 여부값
+ */
+int  fz_score ( fz_scorer_t* sc, char* pat, char* txt, int* fscore, int position[] );
+
 
 /**
  * @brief  list 객체 초기화
+ * @details 실패해도 clear_list 로 해제할 수 있다.
  * @param[in,out] list  초기화할 파일명 리스트 객체
+ * @return 초기화 여부
+ * @retval 1  성공
+ * @retval 0  메모리 부족 (스코어러 버퍼)
  */
-void  init_list (fscore_list_t* list);
+int   init_list (fscore_list_t* list);
 /**
  * @brief  list 객체 아이템 추가
  * @param[in,out] list  파일명 리스트 객체
  * @param[in] item  추가할 파일명
+ * @return 추가 여부
+ * @retval 1  성공
+ * @retval 0  메모리 부족 (또는 65535 바이트를 넘는 파일명)
  */
-void   add_list (fscore_list_t* list, char* item);
+int    add_list (fscore_list_t* list, char* item);
 /**
  * @brief  list 객체 헤제
  * @param[in,out] list  해제할 파일명 리스트 객체
@@ -97,10 +230,40 @@ void   add_list (fscore_list_t* list, char* item);
 void clear_list (fscore_list_t* list);
 
 
+/**
+ * @brief  파일명 인덱스로 파일명 구하기
+ * @details 포인터는 다음 add_list, fz_load_poll 전까지만 유효
+ *          목록 파일의 줄은 처음 구할 때 줄 끝에 '\0' 을 쓰므로 같은 list 에 대해 동시에 부르지 않는다.
+ * @param[in] list  파일명 리스트 객체
+ * @param[in] idx  파일명 인덱스 (0 ~ len-1)
+ */
+char* fz_get_name   (fscore_list_t* list, uint32_t idx);
+/**
+ * @brief  i 번째 후보의 파일명
+ */
+char* fz_cand_name  (fscore_list_t* list, int i);
+/**
+ * @brief  i 번째 후보의 퍼지점수
+ */
+int   fz_cand_score (fscore_list_t* list, int i);
+/**
+ * @brief  i 번째 후보의 현재 패턴 일치위치
+ * @details update_candidates_by_fuzzy_score 가 보이는 상위 후보(cands_topk 개)는 미리 구해 두므로
+ *          화면을 다시 그리거나 커서만 움직일 때는 퍼지점수를 다시 계산하지 않는다.
+ *          그 외의 후보는 처음 요청할 때 구해서 캐시한다.
+ * @param[in] list  파일명 리스트 객체
+ * @param[in] i     후보 위치 (0 ~ cands_cnt-1)
+ * @param[out] pos  일치위치 (0부터, 오름차순), 다음 fz_cand_positions/update_candidates_by_fuzzy_score 전까지 유효
+ * @return 일치위치 개수 (패턴이 비어 있으면 0)
+ */
+int   fz_cand_positions (fscore_list_t* list, int i, uint16_t** pos);
+
+
 /* example
     fscore_list_t list;
     
-    init_list(&list);
+    if(!init_list(&list))
+        return;
 
     add_list(&list, "Makefile");
     add_list(&list, "a.out");
@@ -112,7 +275,7 @@ void clear_list (fscore_list_t* list);
 
     for(int i=0; i < list.cands_cnt; i++)
     {
-        printf("%s [%d]\n", list.cands[i]->fname, list.cands[i]->score);
+        printf("%s [%d]\n", fz_cand_name(&list, i), fz_cand_score(&list, i));
     }
 
     clear_list(&list);
@@ -126,6 +289,74 @@ void clear_list (fscore_list_t* list);
  */
 void  load_file_list ( fscore_list_t* list, char* path, int isfile);
 
+/**
+ * @brief  목록 파일(한 줄에 파일명 하나)을 mmap 해서 그대로 파일명리스트로 사용
+ * @details 파일명을 POOL 로 복사하지 않고 줄 위치/길이만 기록한다. (개행을 한번 훑는 비용)
+ *          파일은 바뀌지 않으며 clear_list 에서 munmap 한다.
+ *          빈 줄과 65535 바이트를 넘는 줄은 건너뛰고, 줄 끝의 '\r' 은 제외한다. (2GB 까지)
+ * @param[in,out] list  파일명리스트 (초기화 됨, 실패해도 clear_list 로 해제)
+ * @param[in] path  목록 파일
+ * @return 성공 여부 (실패하면 0, errno 설정)
+ */
+int   fz_map_list_file ( fscore_list_t* list, char* path );
+
+/**
+ * @brief  백그라운드로 파일명 로드 시작
+ * @details 순회는 별도 스레드에서 하고 찾은 파일명은 fz_load_poll 을 호출할 때 list 에 추가된다.
+ *          로드 중에도 update_candidates_by_fuzzy_score 를 호출할 수 있다.
+ * @param[in,out] list  로드될 파일명리스트 (초기화 됨)
+ * @param[in] path  Base-Path
+ * @param[in] isfile   0이면 디렉토리목록, 그 외는 파일목록
+ * @return 백그라운드 로드 여부 (0 이면 이미 다 읽었거나 실패)
+ */
+int   fz_load_start ( fscore_list_t* list, char* path, int isfile);
+/**
+ * @brief  백그라운드에서 찾은 파일명을 list 에 반영
+ * @details 새 파일명은 마지막 패턴으로 퍼지점수를 구해서 후보에 추가하고 다시 정렬한다.
+ *          감시 모드면 생성/삭제된 파일명도 반영한다.
+ * @param[in,out] list  파일명리스트
+ * @return 화면 갱신 필요 여부 (추가되었거나 로드가 끝남)
+ */
+int   fz_load_poll  ( fscore_list_t* list);
+/**
+ * @brief  백그라운드 로드/감시 알림 fd 지정
+ * @details 순회나 감시 스레드가 batch 를 넘기거나 순회를 마치면 fd 에 1 바이트를 쓴다.
+ *          (pipe 의 쓰기쪽을 O_NONBLOCK 으로 넘기면, 읽기쪽을 poll 하다가 fz_load_poll 을 부르면 된다.)
+ *          가득 차서 쓰지 못한 알림은 버린다. 이미 알림이 남아 있으므로 놓치지 않는다.
+ * @param[in] fd  알림 fd, -1 이면 알리지 않음
+ */
+void  fz_set_notify ( int fd );
+/**
+ * @brief  백그라운드 로드 중인지 여부
+ */
+int   fz_load_busy  ( fscore_list_t* list);
+/**
+ * @brief  백그라운드 로드에서 지금까지 찾은 파일명 개수 (아직 반영되지 않은 것 포함)
+ */
+int   fz_load_found ( fscore_list_t* list);
+
+/**
+ * @brief  인덱스 캐시 디렉토리 지정
+ * @details 지정하면 base-path 별로 파일명 POOL 과 디렉토리 mtime 을 캐시 파일로 저장해 두고,
+ *          다음 로드에서는 캐시 파일을 mmap 해서 바로 쓰면서 백그라운드로 바뀐 디렉토리만 다시 읽는다.
+ *          load_file_list, fz_load_start 에 적용된다.
+ * @param[in] dir  캐시 디렉토리 (없으면 만든다), NULL 이나 "" 이면 캐시를 쓰지 않음
+ */
+void  fz_set_cache_dir ( const char* dir );
+
+/**
+ * @brief  감시 모드 지정
+ * @details 켜면 로드하면서 순회한 디렉토리를 inotify 로 감시해서 생성/삭제된 파일명을
+ *          fz_load_poll 을 호출할 때 list 에 반영한다. (바뀐 파일명만 현재 패턴으로 다시 계산)
+ *          load_file_list, fz_load_start 에 적용되고 clear_list 까지 유지된다. 리눅스만 지원.
+ * @param[in] on  0 이면 끔
+ */
+void  fz_set_watch ( int on );
+/**
+ * @brief  감시 중인지 여부 (fz_load_poll 을 계속 호출해야 함)
+ */
+int   fz_watch_active ( fscore_list_t* list );
+
 /**
  * @brief  로드된 메모리 헤제 및 정리
  * @param[in,out] list  로드된 파일명리스트
@@ -135,10 +366,75 @@ void clear_file_list ( fscore_list_t* list);
 /**
  * @brief  주어진 패턴에 따라 퍼지검색 후보 갱신
  * @details 퍼지스코어를 구해서 list->cands 에 후보를 등록, list->cands_cnt 개수만큼 생성됨
+ *          fz_set_cancel 로 중단되면 마지막으로 완료된 (패턴 앞부분의) 후보로 남으므로 다시 호출해야 한다.
  * @param[in,out] list  로드된 파일명리스트
  * @param[in] pat  입력 퍼지 패턴 
+ * @retval 1  완료
+ * @retval 0  중단됨
+ */
+int  update_candidates_by_fuzzy_score ( fscore_list_t* list , char* pat );
+
+/**
+ * @brief  후보 갱신 중단 확인 함수 등록
+ * @details update_candidates_by_fuzzy_score 가 퍼지점수 계산 조각(FZ_CHUNK_SIZE 개)마다
+ *          호출한 스레드에서 cancel(arg) 를 부르고, 0 이 아니면 남은 계산을 버린다.
+ *          (예: 새 키 입력이 있으면 지난 패턴의 계산을 그만두고 최신 패턴으로 다시 호출)
+ * @param[in,out] list  파일명 리스트 객체
+ * @param[in] cancel  중단 확인 함수, NULL 이면 해제
+ * @param[in] arg  cancel 에 넘길 인자
+ */
+void fz_set_cancel ( fscore_list_t* list, int (*cancel)(void* arg), void* arg );
+
+/**
+ * @brief  list 를 바꾸지 않는 퍼지검색
+ * @details 결과는 스코어러와 호출자 버퍼에만 기록하므로, 로드/갱신 중이 아닌 같은 list 에
+ *          스레드마다 다른 스코어러로 동시에 호출할 수 있다. (list 의 후보, 점수는 그대로)
+ *          빈 패턴은 추가된 순서대로 전체.
+ * @param[in,out] sc  스코어러
+ * @param[in] list  파일명리스트
+ * @param[in] pat  패턴 (MAX_PATTERN 을 넘으면 잘라서 사용)
+ * @param[out] idx  점수순으로 cap 개까지 파일명 인덱스 (fz_get_name 으로 파일명)
+ * @param[out] scores  idx 별 퍼지점수, NULL 이면 기록하지 않음
+ * @param[in] cap  idx, scores 크기
+ * @return 일치한 전체 개수 (cap 보다 클 수 있음), 메모리가 부족하면 -1
+ */
+int  fz_query ( fz_scorer_t* sc, fscore_list_t* list, char* pat, uint32_t* idx, int* scores, int cap );
+/**
+ * @brief  list 의 후보 갱신에 사용할 가중치 지정
+ * @details sc 의 가중치만 복사하고 점진 검색용 후보 스택은 버린다.
+ * @param[in,out] list  파일명리스트
+ * @param[in] sc  가중치를 가져올 스코어러
+ */
+void fz_set_list_scorer ( fscore_list_t* list, fz_scorer_t* sc );
+
+/**
+ * @brief  후보 앞부분 정렬 보장
+ * @details cands_topk 로 일부만 정렬된 경우, 스크롤 등으로 더 필요할 때 호출
+ * @param[in,out] list  파일명리스트
+ * @param[in] cnt  정렬이 필요한 후보 개수
+ * @return 정렬이 완료된 후보 개수
+ */
+int  fz_order_candidates ( fscore_list_t* list, int cnt );
+
+/**
+ * @brief  퍼지점수 계산에 사용할 스레드 개수 지정
+ * @details 첫 병렬계산 전에만 적용된다. 0 이하이면 환경변수 FZ_THREADS, 그것도 없으면 CPU 개수를 사용.
+ *          리스트가 작으면 스레드 개수와 관계없이 직렬로 계산한다.
+ * @param[in] cnt  스레드 개수 (1 이면 항상 직렬)
+ */
+void fz_set_thread_count ( int cnt );
+/**
+ * @brief  퍼지점수 계산에 사용하는 스레드 개수
+ * @return 스레드 개수 (호출 스레드 포함)
+ */
+int  fz_get_thread_count ( void );
+
+/**
+ * @brief  동작 통계 (fscore_list_t::stats) 수집 여부
+ * @details 끄면 시각을 재지 않고 카운터도 반영하지 않는다. fz_query 는 list 를 바꾸지 않으므로 세지 않는다.
+ * @param[in] on  1 이면 수집
  */
-void update_candidates_by_fuzzy_score ( fscore_list_t* list , char* pat );
+void fz_set_stats ( int on );
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,1011 @@
+/*
+    fz 벤치마크
+
+    $ gcc -O2 -o fz_bench fz_bench.c -lpthread
+    $ ./fz_bench                          # 합성 트리 (100000 파일) 생성 후 측정
+    $ ./fz_bench -r /usr -s 'inclstdio<<<<<sys'
+    $ ./fz_bench -l paths.txt
+    $ ./fz_bench -K                       # 퍼지점수 계산 구현별 일치 검사
+    $ ./fz_bench -M                       # 퍼지점수 계산 구현별 처리량
+
+    - 색인: load_file_list (또는 목록 파일) 처리량을 따로 측정
+    - 입력: 스크립트의 글자를 한 글자씩 치고 '<' 는 백스페이스로 재생
+      키 하나마다 update_candidates_by_fuzzy_score + 보이는 만큼 정렬 + 보이는 줄의 일치위치 (화면 갱신과 같은 순서)
+    - 키별 지연시간 p50/p99, 점수 계산한 파일명 개수, 최대 RSS 출력
+    - 계산 구현(행렬, 한 행, SIMD 레인)끼리 같은 점수/위치인지 검사하고 초당 계산량 비교
+
+    점수 계산 개수는 동작 통계(fz_set_stats)로 세고,
+    내부 계산 함수를 직접 비교하기 위해 fz.c 를 그대로 포함한다.
+*/
+#include "fz.c"
+
+#include <sys/resource.h>
+
+
+/* 합성 트리의 디렉토리/파일명 단어 */
+static const char* g_words[] =
+{
+    "src", "lib", "core", "util", "test", "main", "config", "net",
+    "http", "parser", "render", "window", "io", "fs", "cache", "index",
+    "query", "score", "model", "view", "widget", "event", "thread", "buffer",
+    "stream", "json", "xml", "image", "audio", "video", "doc", "build",
+    "tools", "api", "server", "client", "auth", "user", "data", "db",
+    "log", "common", "platform", "driver", "kernel", "shader", "font", "locale",
+};
+#define WORD_CNT  ((int) (sizeof(g_words) / sizeof(g_words[0])))
+
+static const char* g_exts[] =
+{
+    "c", "h", "cpp", "hpp", "py", "js", "ts", "go", "rs", "java", "md", "txt", "json", "yaml", "o",
+};
+#define EXT_CNT  ((int) (sizeof(g_exts) / sizeof(g_exts[0])))
+
+/* 기본 입력 스크립트 ('<' 백스페이스) */
+static const char* g_default_scripts[] =
+{
+    "srcmain",
+    "confparse<<<<<util",
+    "nettest.c",
+    "rendwin<<<<<<<shadervk",
+    "apiserv<<<<clientauth",
+    "a<b<c<d<",
+};
+#define DEFAULT_SCRIPT_CNT  ((int) (sizeof(g_default_scripts) / sizeof(g_default_scripts[0])))
+
+#define MAX_SCRIPTS   (32)
+#define VISIBLE_ROWS  (20)
+#define FZ_LANES_MAX  (16)   /* 한 묶음의 파일명 개수 (FZ_SIMD 가 없어도 같은 크기) */
+
+typedef struct bench_opt_st
+{
+    int   files;      /* 합성 트리 파일 개수 */
+    int   depth;      /* 최대 깊이 */
+    int   fanout;     /* 디렉토리별 하위 디렉토리 개수 */
+    unsigned int seed;
+    char* root;       /* 이미 있는 디렉토리 색인 */
+    char* list;       /* 목록 파일 (add_list) */
+    char* map;        /* 목록 파일 (fz_map_list_file) */
+    char* tree_dir;   /* 합성 트리를 만들 상위 디렉토리, 없으면 $TMPDIR */
+    int   keep;       /* 합성 트리 남김 */
+    int   reps;
+    int   rows;
+    char* scripts[MAX_SCRIPTS];
+    int   script_cnt;
+    int   check;      /* -K 반복 횟수 */
+    int   micro;      /* -M */
+} bench_opt_t;
+
+/* 키 하나의 측정값 */
+typedef struct bench_key_st
+{
+    double ms;
+    long long scored;
+    int  back;       /* 백스페이스 */
+    int  script;
+} bench_key_t;
+
+
+static unsigned int g_rand;
+
+/* xorshift32, 같은 seed 면 같은 트리 */
+static unsigned int bench_rand()
+{
+    g_rand ^= g_rand << 13;
+    g_rand ^= g_rand >> 17;
+    g_rand ^= g_rand << 5;
+    return g_rand;
+}
+
+static double bench_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static double peak_rss_mb()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss / 1024.0;   /* linux 는 KB */
+}
+
+/*
+    합성 경로 하나 (base 아래 상대경로)
+    - 깊이는 1 ~ depth, 얕은 쪽이 많도록
+    - 디렉토리명은 단계와 번호로 정해지므로 fanout 만큼만 갈라진다.
+    - 파일명은 snake/camel/dash 섞어서 (보너스 종류가 골고루 나오도록)
+*/
+static int gen_path(bench_opt_t* opt, char* buf, int size)
+{
+    int depth = 1 + (bench_rand() % opt->depth) * (bench_rand() % opt->depth) / opt->depth;
+    int len = 0;
+
+    for(int d=0; d < depth - 1; d++)
+    {
+        int k = bench_rand() % opt->fanout;
+        const char* w = g_words[(k * 7 + d * 3) % WORD_CNT];
+        if(k < WORD_CNT / 7)
+            len += snprintf(buf + len, size - len, "%s/", w);
+        else
+            len += snprintf(buf + len, size - len, "%s%d/", w, k);
+    }
+
+    const char* a = g_words[bench_rand() % WORD_CNT];
+    const char* b = g_words[bench_rand() % WORD_CNT];
+    const char* ext = g_exts[bench_rand() % EXT_CNT];
+    switch(bench_rand() % 4)
+    {
+        case 0:
+            len += snprintf(buf + len, size - len, "%s_%s.%s", a, b, ext);
+            break;
+        case 1:
+            len += snprintf(buf + len, size - len, "%c%s%c%s.%s", toupper(a[0]), a + 1, toupper(b[0]), b + 1, ext);
+            break;
+        case 2:
+            len += snprintf(buf + len, size - len, "%s-%s%u.%s", a, b, bench_rand() % 100, ext);
+            break;
+        default:
+            len += snprintf(buf + len, size - len, "%s.%s", a, ext);
+            break;
+    }
+    return len;
+}
+
+/*
+    합성 트리를 base 아래에 생성, 만든 파일 개수 반환
+    같은 경로가 나오면 다시 뽑아서 opt->files 개를 채운다.
+    (fanout/depth 가 작아 경로가 모자라면 시도 횟수 제한에서 멈추고 만든 만큼 반환)
+*/
+static int make_tree(bench_opt_t* opt, char* base)
+{
+    char path[MAX_PATH_LEN * 2];
+    int made = 0;
+    long tries = (long) opt->files * 16 + 1024;
+
+    g_rand = opt->seed ? opt->seed : 1;
+    while(made < opt->files && tries-- > 0)
+    {
+        int blen = snprintf(path, sizeof(path), "%s/", base);
+        gen_path(opt, path + blen, sizeof(path) - blen);
+
+        /* 중간 디렉토리 */
+        for(char* p = path + blen; *p; p++)
+        {
+            if(*p != '/')
+                continue;
+            *p = '\0';
+            if(mkdir(path, 0755) != 0 && errno != EEXIST)
+                return -1;
+            *p = '/';
+        }
+        int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if(fd >= 0)
+        {
+            close(fd);
+            made++;
+        }
+        else if(errno != EEXIST)
+        {
+            return -1;
+        }
+    }
+    return made;
+}
+
+static void remove_tree(char* path)
+{
+    DIR* dir = opendir(path);
+    if(dir != NULL)
+    {
+        struct dirent* ent;
+        char sub[PATH_MAX];
+        while( (ent = readdir(dir)) != NULL )
+        {
+            if(strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+                continue;
+            snprintf(sub, sizeof(sub), "%s/%s", path, ent->d_name);
+            if(ent->d_type == DT_DIR)
+                remove_tree(sub);
+            else
+                unlink(sub);
+        }
+        closedir(dir);
+    }
+    rmdir(path);
+}
+
+/* 목록 파일을 한 줄씩 add_list */
+static int load_list_file(fscore_list_t* list, char* path)
+{
+    FILE* fp = fopen(path, "r");
+    if(fp == NULL)
+        return 0;
+
+    if(!init_list(list))
+    {
+        fclose(fp);
+        return 0;
+    }
+    char* line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while( (len = getline(&line, &cap, fp)) >= 0 )
+    {
+        while(len > 0 && (line[len-1] == '\n' || line[len-1] == '\r'))
+            line[--len] = '\0';
+        if(len > 0)
+            add_list(list, line);
+    }
+    free(line);
+    fclose(fp);
+    return 1;
+}
+
+/* 키 하나 처리 (화면 갱신과 같은 순서), 걸린 시간(ms) 반환 */
+static double replay_key(fscore_list_t* list, char* pat, int rows)
+{
+    uint16_t* pos;
+
+    double t0 = bench_ms();
+    update_candidates_by_fuzzy_score(list, pat);
+    fz_order_candidates(list, rows);
+    for(int i=0; i < rows && i < list->cands_cnt; i++)
+        fz_cand_positions(list, i, &pos);
+    return bench_ms() - t0;
+}
+
+/* 스크립트 하나 재생, keys 에 기록한 개수 반환 */
+static int replay_script(fscore_list_t* list, char* script, int idx, int rows, bench_key_t* keys)
+{
+    char pat[MAX_PATTERN + 1] = "";
+    int patlen = 0;
+    int cnt = 0;
+
+    /* 빈 패턴에서 시작 (점진 검색 단계도 모두 버려진다) */
+    update_candidates_by_fuzzy_score(list, pat);
+
+    for(char* c = script; *c; c++)
+    {
+        int back = (*c == '<');
+        if(back)
+        {
+            if(patlen == 0)
+                continue;
+            pat[--patlen] = '\0';
+        }
+        else
+        {
+            if(patlen >= MAX_PATTERN)
+                continue;
+            pat[patlen++] = *c;
+            pat[patlen] = '\0';
+        }
+
+        uint64_t scored = list->stats.scored;
+        keys[cnt].ms = replay_key(list, pat, rows);
+        keys[cnt].scored = list->stats.scored - scored;
+        keys[cnt].back = back;
+        keys[cnt].script = idx;
+        cnt++;
+    }
+    return cnt;
+}
+
+static int comp_double(const void* a, const void* b)
+{
+    double aa = *(double*) a;
+    double bb = *(double*) b;
+    return aa < bb ? -1 : aa > bb ? 1 : 0;
+}
+
+/* 조건에 맞는 키들의 분포 출력 (script < 0 이면 전체, back < 0 이면 전부) */
+static void report_keys(char* title, bench_key_t* keys, int cnt, int script, int back)
+{
+    double* ms = (double*) malloc (sizeof(double) * (cnt + 1));
+    int n = 0;
+    double sum = 0;
+    long long scored = 0;
+
+    for(int i=0; i < cnt; i++)
+    {
+        if((script >= 0 && keys[i].script != script) || (back >= 0 && keys[i].back != back))
+            continue;
+        ms[n++] = keys[i].ms;
+        sum += keys[i].ms;
+        scored += keys[i].scored;
+    }
+    if(n == 0)
+    {
+        free(ms);
+        return;
+    }
+    qsort(ms, n, sizeof(double), comp_double);
+
+    printf("  %-24.24s %6d %9.3f %9.3f %9.3f %9.3f %12.0f\n",
+           title, n, ms[(n - 1) * 50 / 100], ms[(n - 1) * 99 / 100], ms[n - 1], sum / n,
+           (double) scored / n);
+    free(ms);
+}
+
+/*
+    퍼지점수 계산 구현별 일치 검사 (-K)
+
+    fuzzy_score_core (전체 행렬, 위치까지) 를 기준으로 같은 (패턴, 파일명) 에 대해
+    - fuzzy_score_only                 : 일치 여부, 점수
+    - SIMD 레인 (avx2)                  : 레인 16 개를 여러 길이로 섞어서 점수 (CPU 가 지원하고 가중치가 16비트에 들어갈 때)
+    - fz_score, get_fuzzy_score(_in_list) : 일치 여부, 점수, 위치
+    - fz_query (목록 파일 줄 포함)      : 사전필터를 거친 후보 집합과 점수
+    위치는 패턴 글자마다 하나씩, 순서대로 같은 글자(소문자)인지도 따로 세어서 알려준다.
+    (역추적은 화면 강조용이라 일치하지 않는 글자를 고를 수 있음, 불일치로 치지 않음)
+    가중치는 기본값과 임의값을 섞는다.
+*/
+#define CHECK_ALPHABET  "aAbBcz_/.-x1Z \xc3\xa9"
+#define CHECK_MAX_FAIL  (10)
+
+typedef struct check_st
+{
+    fz_scorer_t sc;
+    int*  row;
+    int*  row_cont;
+    long long pairs;
+    long long compared;
+    long long traceback;   /* 위치가 패턴과 맞지 않는 역추적 */
+    int   failed;
+#ifdef FZ_SIMD
+    fz_lanes_t* lanes;
+    fz_lanes_fn fns[1];
+    const char* fn_names[1];
+    int   fn_cnt;
+#endif
+} check_t;
+
+typedef struct check_ref_st
+{
+    int ret;
+    int score;
+    int position[MAX_PATH_LEN];
+} check_ref_t;
+
+static void check_fail(check_t* ck, char* what, char* pat, char* txt, int want, int got)
+{
+    if(ck->failed++ < CHECK_MAX_FAIL)
+        printf("MISMATCH %-12s pat \"%s\" txt \"%.60s%s\" (len %d) want %d got %d\n",
+               what, pat, txt, strlen(txt) > 60 ? "..." : "", (int) strlen(txt), want, got);
+}
+
+/* 임의 문자열 (len 글자) */
+static void rand_text(char* buf, int len)
+{
+    const char* al = CHECK_ALPHABET;
+    int al_len = strlen(al);
+    for(int i=0; i < len; i++)
+        buf[i] = al[bench_rand() % al_len];
+    buf[len] = '\0';
+}
+
+/* 짧은 쪽이 많도록 1 ~ max */
+static int rand_len(int max)
+{
+    switch(bench_rand() % 8)
+    {
+        case 0:  return max;
+        case 1:  return 1 + bench_rand() % max;
+        default: return 1 + bench_rand() % (max < 48 ? max : 48);
+    }
+}
+
+/* 가중치만 기본값으로 (init_weights 와 달리 버퍼는 그대로) */
+static void default_weights(fz_scorer_t* sc)
+{
+    sc->score_match      = FZ_SCORE_MATCH;
+    sc->bonus_boundary   = FZ_BONUS_BOUNDARY;
+    sc->bonus_no_alnum   = FZ_BONUS_NO_ALNUM;
+    sc->bonus_camel      = FZ_BONUS_CAMEL;
+    sc->bonus_continuous = FZ_BONUS_CONTINUOUS;
+    sc->penalty_ingap    = FZ_PENALTY_INGAP;
+    sc->penalty_firstgap = FZ_PENALTY_FIRSTGAP;
+}
+
+static void rand_weights(fz_scorer_t* sc)
+{
+    default_weights(sc);
+    if(bench_rand() % 4 != 0)
+        return;
+
+    sc->score_match      = bench_rand() % 40;
+    sc->bonus_boundary   = bench_rand() % 40;
+    sc->bonus_no_alnum   = bench_rand() % 40;
+    sc->bonus_camel      = bench_rand() % 40;
+    sc->bonus_continuous = bench_rand() % 40;
+    sc->penalty_ingap    = -(int) (bench_rand() % 20);
+    sc->penalty_firstgap = -(int) (bench_rand() % 20);
+    /* 가끔 16비트를 넘을 수 있는 가중치 (SIMD 는 쓰지 않아야 함) */
+    if(bench_rand() % 8 == 0)
+        sc->score_match = 600 + bench_rand() % 1000;
+}
+
+static int is_default_weights(fz_scorer_t* sc)
+{
+    return sc->score_match == FZ_SCORE_MATCH && sc->bonus_boundary == FZ_BONUS_BOUNDARY &&
+           sc->bonus_no_alnum == FZ_BONUS_NO_ALNUM && sc->bonus_camel == FZ_BONUS_CAMEL &&
+           sc->bonus_continuous == FZ_BONUS_CONTINUOUS &&
+           sc->penalty_ingap == FZ_PENALTY_INGAP && sc->penalty_firstgap == FZ_PENALTY_FIRSTGAP;
+}
+
+/* 위치가 패턴 글자마다 하나씩 순서대로 같은 글자인지 */
+static int check_positions(char* pat, char* txt, int len, int* position)
+{
+    int k = 0;
+    for(int i=0; i < len; i++)
+    {
+        if(position[i] == 0)
+            continue;
+        if(pat[k] == '\0' || tolower(pat[k]) != tolower(txt[i]))
+            return 0;
+        k++;
+    }
+    return pat[k] == '\0';
+}
+
+/* 기준값과 스칼라 구현들 비교 */
+static void check_pair(check_t* ck, fscore_list_t* list, char* pat, char* txt, check_ref_t* ref)
+{
+    fz_scorer_t* sc = &ck->sc;
+    int len = strlen(txt);
+    char shadow[ FZ_SHADOW_SIZE(MAX_PATH_LEN) ];
+    int position[MAX_PATH_LEN];
+    int score = 0;
+
+    make_shadow(txt, len, shadow, (unsigned char*) shadow + len);
+    memset(ref->position, 0x00, sizeof(ref->position));
+    ref->score = 0;
+    ref->ret = fuzzy_score_core(sc, sc->_matrix, sc->_cont, pat,
+                                shadow, (unsigned char*) shadow + len, len, &ref->score, ref->position);
+    ck->pairs++;
+
+    if(ref->ret && !check_positions(pat, txt, len, ref->position))
+        ck->traceback++;
+
+    int ret = fuzzy_score_only(sc, ck->row, ck->row_cont, pat,
+                               shadow, (unsigned char*) shadow + len, len, &score);
+    if(ret != ref->ret || (ret && score != ref->score))
+        check_fail(ck, "score_only", pat, txt, ref->ret ? ref->score : -1, ret ? score : -1);
+    ck->compared++;
+
+    /* 공개 함수들은 같은 위치까지 */
+    for(int v=0; v < 3; v++)
+    {
+        if(v == 2 && !is_default_weights(sc))
+            continue;
+        memset(position, 0x00, sizeof(position));
+        score = 0;
+        if(v == 0)
+            ret = fz_score(sc, pat, txt, &score, position);
+        else if(v == 1)
+            ret = get_fuzzy_score_in_list(list, pat, txt, &score, position);
+        else
+            ret = get_fuzzy_score(pat, txt, &score, position);
+
+        char* name = v == 0 ? "fz_score" : v == 1 ? "in_list" : "get_fuzzy";
+        if(ret != ref->ret || (ret && score != ref->score))
+            check_fail(ck, name, pat, txt, ref->ret ? ref->score : -1, ret ? score : -1);
+        else if(ret && memcmp(position, ref->position, sizeof(int) * len) != 0)
+            check_fail(ck, name, pat, txt, 1, 0);
+        ck->compared++;
+    }
+}
+
+/* 파일명 n 개를 한 묶음으로 SIMD 레인, fz_query 와 비교 */
+static void check_batch(check_t* ck, char* pat, char texts[][MAX_PATH_LEN + 1], int n)
+{
+    fz_scorer_t* sc = &ck->sc;
+    fscore_list_t list;
+    check_ref_t ref[FZ_LANES_MAX];
+    uint32_t idx[FZ_LANES_MAX];
+    int scores[FZ_LANES_MAX];
+
+    if(!init_list(&list))
+    {
+        ck->failed++;
+        return;
+    }
+    fz_set_list_scorer(&list, sc);
+    for(int i=0; i < n; i++)
+    {
+        add_list(&list, texts[i]);
+        check_pair(ck, &list, pat, texts[i], &ref[i]);
+    }
+
+#ifdef FZ_SIMD
+    if(get_lanes_fn(sc) != NULL)
+    {
+        uint32_t ents[FZ_LANES];
+        int res[FZ_LANES];
+        for(int i=0; i < n; i++)
+            ents[i] = i;
+        for(int f=0; f < ck->fn_cnt; f++)
+        {
+            ck->fns[f](sc, ck->lanes, pat, fill_lanes(sc, ck->lanes, &list, ents, n), res);
+            for(int i=0; i < n; i++)
+            {
+                int want = ref[i].ret ? ref[i].score : -1;
+                if(res[i] != want)
+                    check_fail(ck, (char*) ck->fn_names[f], pat, texts[i], want, res[i]);
+                ck->compared++;
+            }
+        }
+    }
+#endif
+
+    /* fz_query : 두번째는 목록 파일의 줄처럼 (shadow 를 그때 구함) */
+    for(int v=0; v < 2; v++)
+    {
+        if(v == 1)
+            for(int i=0; i < n; i++)
+                list._flags[i] |= FZ_ENTRY_LINE;
+
+        int got[FZ_LANES_MAX];
+        for(int i=0; i < n; i++)
+            got[i] = -1;
+        int cnt = fz_query(sc, &list, pat, idx, scores, n);
+        for(int i=0; i < cnt && i < n; i++)
+            got[idx[i]] = scores[i];
+        for(int i=0; i < n; i++)
+        {
+            int want = ref[i].ret ? ref[i].score : -1;
+            if(got[i] != want)
+                check_fail(ck, v ? "query_line" : "fz_query", pat, texts[i], want, got[i]);
+            ck->compared++;
+        }
+    }
+    clear_list(&list);
+}
+
+/* 경계값 (패턴, 파일명) */
+static void check_edges(check_t* ck)
+{
+    static const char* edges[][2] =
+    {
+        { "a", "a" }, { "a", "b" }, { "A", "a" }, { "ab", "a" }, { "abc", "ab" },
+        { "aaa", "aaaaaaaa" }, { "aa", "a_a_a_a" }, { "fz", "FuzzyZ" }, { "fz", "fz.c" },
+        { "FZ", "fz.h" }, { "ab", "a/b" }, { "ab", "xAxB" }, { "mc", "myCamelCase" },
+        { "/", "a/b/c" }, { ".", "..." }, { " ", "a b" }, { "\xc3", "caf\xc3\xa9" },
+        { "zz", "z" }, { "src", "s/r/c/src" }, { "srcmain", "src/main.c" },
+    };
+    char texts[FZ_LANES_MAX][MAX_PATH_LEN + 1];
+    char pat[MAX_PATTERN + 1];
+
+    default_weights(&ck->sc);
+    for(int i=0; i < (int) (sizeof(edges) / sizeof(edges[0])); i++)
+    {
+        strcpy(texts[0], edges[i][1]);
+        strcpy(pat, edges[i][0]);
+        check_batch(ck, pat, texts, 1);
+    }
+
+    /* 최대 길이: 같은 글자만, 끝에만 일치, 레인마다 길이가 다름 */
+    memset(pat, 'a', MAX_PATTERN);
+    pat[MAX_PATTERN] = '\0';
+    for(int i=0; i < FZ_LANES_MAX; i++)
+    {
+        int len = MAX_PATH_LEN - i * 31;
+        memset(texts[i], i % 2 ? 'a' : 'x', len);
+        texts[i][len] = '\0';
+        if(i % 2 == 0)
+            memset(texts[i] + len - MAX_PATTERN, 'A', MAX_PATTERN);
+    }
+    check_batch(ck, pat, texts, FZ_LANES_MAX);
+}
+
+static int run_check(unsigned int seed, int iters)
+{
+    check_t ck;
+    memset(&ck, 0x00, sizeof(ck));
+    if(!fz_scorer_init(&ck.sc))
+        return 2;
+    ck.row = (int*) malloc (sizeof(int) * (MAX_PATH_LEN + 1));
+    ck.row_cont = (int*) malloc (sizeof(int) * (MAX_PATH_LEN + 1));
+#ifdef FZ_SIMD
+    ck.lanes = alloc_lanes();
+    if(__builtin_cpu_supports("avx2"))
+    {
+        ck.fns[ck.fn_cnt] = score_lanes_avx2;
+        ck.fn_names[ck.fn_cnt++] = "lanes_avx2";
+    }
+    printf("kernels: core (reference), score_only");
+    for(int f=0; f < ck.fn_cnt; f++)
+        printf(", %s", ck.fn_names[f]);
+    printf(", fz_score, get_fuzzy_score, get_fuzzy_score_in_list, fz_query\n");
+#else
+    printf("kernels: core (reference), score_only, fz_score, get_fuzzy_score, get_fuzzy_score_in_list, fz_query\n");
+#endif
+
+    check_edges(&ck);
+
+    char texts[FZ_LANES_MAX][MAX_PATH_LEN + 1];
+    char pat[MAX_PATTERN + 1];
+    g_rand = seed ? seed : 1;
+    for(int it=0; it < iters; it++)
+    {
+        rand_weights(&ck.sc);
+        int plen = rand_len(bench_rand() % 4 == 0 ? MAX_PATTERN : 6);
+        rand_text(pat, plen);
+
+        int n = 1 + bench_rand() % FZ_LANES_MAX;
+        for(int i=0; i < n; i++)
+        {
+            int len = rand_len(MAX_PATH_LEN);
+            rand_text(texts[i], len);
+            /* 반쯤은 패턴을 부분열로 심어서 일치하도록 */
+            if(bench_rand() % 2 && len >= plen)
+            {
+                int pos = 0;
+                for(int k=0; k < plen; k++)
+                {
+                    pos += bench_rand() % ((len - pos) - (plen - k) + 1);
+                    texts[i][pos++] = bench_rand() % 2 ? pat[k] : toupper(pat[k]);
+                }
+            }
+        }
+        check_batch(&ck, pat, texts, n);
+    }
+
+    if(ck.traceback > 0)
+        printf("note: %lld tracebacks mark characters outside the pattern (highlight only)\n", ck.traceback);
+    printf("checked %lld pairs, %lld comparisons, seed %u: %s (%d mismatches)\n",
+           ck.pairs, ck.compared, seed, ck.failed ? "FAIL" : "OK", ck.failed);
+
+    fz_scorer_free(&ck.sc);
+    free(ck.row);
+    free(ck.row_cont);
+#ifdef FZ_SIMD
+    free(ck.lanes);
+#endif
+    return ck.failed ? 1 : 0;
+}
+
+
+/*
+    퍼지점수 계산 구현별 처리량 (-M)
+    패턴 길이 x 파일명 길이 마다 패턴이 부분열로 들어있는 파일명들을 계산해서
+    초당 계산한 칸 수 (패턴 길이 x 파일명 길이) 를 출력 (Mcells/s)
+    SIMD 레인은 fill_lanes (레인 배치) 비용 포함
+*/
+#define MICRO_TEXTS   (256)
+#define MICRO_CELLS   (4000000.0)
+
+enum { MICRO_CORE, MICRO_ONLY, MICRO_AVX2, MICRO_KINDS };
+
+static const char* g_micro_names[MICRO_KINDS] = { "core", "score_only", "lanes_avx2" };
+
+static volatile int g_micro_sink;
+
+static double micro_run(int kind, fz_scorer_t* sc, fscore_list_t* list, char* pat, int len, int* row, int* row_cont,
+                        fz_lanes_t* lanes, int reps)
+{
+    int position[MAX_PATH_LEN];
+    int score = 0;
+    int sum = 0;
+
+    double t0 = bench_ms();
+    for(int r=0; r < reps; r++)
+    {
+        if(kind == MICRO_CORE || kind == MICRO_ONLY)
+        {
+            for(int i=0; i < list->len; i++)
+            {
+                char* name = ENT_NAME(list, i);
+                if(kind == MICRO_CORE)
+                    fuzzy_score_core(sc, sc->_matrix, sc->_cont, pat,
+                                     ENT_LOWER(name, len), ENT_BONUS(name, len), len, &score, position);
+                else
+                    fuzzy_score_only(sc, row, row_cont, pat,
+                                     ENT_LOWER(name, len), ENT_BONUS(name, len), len, &score);
+                sum += score;
+            }
+        }
+#ifdef FZ_SIMD
+        else
+        {
+            fz_lanes_fn fn = score_lanes_avx2;
+            uint32_t ents[FZ_LANES];
+            int res[FZ_LANES];
+            for(int i=0; i < list->len; i += FZ_LANES)
+            {
+                for(int k=0; k < FZ_LANES; k++)
+                    ents[k] = i + k;
+                fn(sc, lanes, pat, fill_lanes(sc, lanes, list, ents, FZ_LANES), res);
+                sum += res[0];
+            }
+        }
+#endif
+    }
+    g_micro_sink = sum;
+    return bench_ms() - t0;
+}
+
+static int run_micro(unsigned int seed)
+{
+    static const int plens[] = { 1, 2, 4, 8, 16, 32 };
+    static const int tlens[] = { 16, 32, 64, 128, 256, 512 };
+    int avail[MICRO_KINDS] = { 1, 1, 0 };
+
+    fz_scorer_t sc;
+    if(!fz_scorer_init(&sc))
+        return 2;
+    int* row = (int*) malloc (sizeof(int) * (MAX_PATH_LEN + 1));
+    int* row_cont = (int*) malloc (sizeof(int) * (MAX_PATH_LEN + 1));
+    fz_lanes_t* lanes = NULL;
+#ifdef FZ_SIMD
+    lanes = alloc_lanes();
+    avail[MICRO_AVX2] = __builtin_cpu_supports("avx2") != 0;
+#endif
+
+    printf("Mcells/s (pattern length x name length), %d names per run, default weights\n", MICRO_TEXTS);
+    printf("  %4s %4s", "pat", "name");
+    for(int k=0; k < MICRO_KINDS; k++)
+        if(avail[k])
+            printf(" %12s", g_micro_names[k]);
+    printf("\n");
+
+    g_rand = seed ? seed : 1;
+    const char* al = "abcdefghijklmnopqrstuvwxyz/_.";
+    char pat[MAX_PATTERN + 1];
+    char txt[MAX_PATH_LEN + 1];
+    for(int p=0; p < (int) (sizeof(plens) / sizeof(plens[0])); p++)
+    {
+        for(int t=0; t < (int) (sizeof(tlens) / sizeof(tlens[0])); t++)
+        {
+            int plen = plens[p];
+            int tlen = tlens[t];
+            if(plen > tlen)
+                continue;
+
+            for(int k=0; k < plen; k++)
+                pat[k] = al[bench_rand() % 26];
+            pat[plen] = '\0';
+
+            /* 모든 파일명에 패턴이 들어있어서 끝까지 계산하도록 */
+            fscore_list_t list;
+            if(!init_list(&list))
+            {
+                printf("  %4d %4d out of memory\n", plen, tlen);
+                continue;
+            }
+            for(int i=0; i < MICRO_TEXTS; i++)
+            {
+                for(int k=0; k < tlen; k++)
+                    txt[k] = al[bench_rand() % strlen(al)];
+                txt[tlen] = '\0';
+                int pos = 0;
+                for(int k=0; k < plen; k++)
+                {
+                    pos += bench_rand() % ((tlen - pos) - (plen - k) + 1);
+                    txt[pos++] = pat[k];
+                }
+                add_list(&list, txt);
+            }
+
+            double cells = (double) plen * tlen * MICRO_TEXTS;
+            int reps = MICRO_CELLS / cells;
+            if(reps < 1)
+                reps = 1;
+
+            printf("  %4d %4d", plen, tlen);
+            for(int k=0; k < MICRO_KINDS; k++)
+            {
+                if(!avail[k])
+                    continue;
+                micro_run(k, &sc, &list, pat, tlen, row, row_cont, lanes, 1);   /* 예열 */
+                double ms = micro_run(k, &sc, &list, pat, tlen, row, row_cont, lanes, reps);
+                printf(" %12.1f", ms > 0 ? cells * reps / (ms * 1e3) : 0.0);
+            }
+            printf("\n");
+            clear_list(&list);
+        }
+    }
+
+    fz_scorer_free(&sc);
+    free(row);
+    free(row_cont);
+    free(lanes);
+    return 0;
+}
+
+static void show_usage()
+{
+    char* usage =
+        " fz benchmark\n"\
+        "    색인 처리량과 키 입력별 지연시간을 측정합니다.\n\n"\
+        "    $ fz_bench [-n files] [-d depth] [-f fanout] [-S seed] [-t dir] [-k]\n"\
+        "               [-r dir | -l list | -i list] [-s script]... [-R reps] [-v rows] [-j threads]\n"\
+        "    $ fz_bench -K [-N iterations] [-S seed]\n"\
+        "    $ fz_bench -M\n"\
+        "\n"\
+        "    Option:\n"\
+        "       -n N    합성 트리 파일 개수 (기본: 100000)\n"\
+        "       -d N    합성 트리 최대 깊이 (기본: 8)\n"\
+        "       -f N    디렉토리별 하위 디렉토리 개수 (기본: 8)\n"\
+        "       -S N    난수 seed, 같으면 같은 트리 (기본: 1)\n"\
+        "       -t DIR  합성 트리를 DIR 아래에 생성 (기본: 임시 디렉토리)\n"\
+        "       -k      측정 후 합성 트리를 지우지 않음\n"\
+        "       -r DIR  합성 트리 대신 이미 있는 디렉토리 색인\n"\
+        "       -l F    목록 파일 (한 줄에 하나) 을 add_list 로 읽음\n"\
+        "       -i F    목록 파일을 fz_map_list_file 로 읽음\n"\
+        "       -s S    입력 스크립트, '<' 는 백스페이스 (여러번 지정 가능)\n"\
+        "       -R N    스크립트별 반복 횟수 (기본: 5)\n"\
+        "       -v N    화면에 보이는 줄 수 (기본: 20)\n"\
+        "       -j N    퍼지검색 스레드 개수\n"\
+        "       -K      퍼지점수 계산 구현(행렬, 한 행, SIMD 레인, 공개 함수)끼리 점수/위치 일치 검사\n"\
+        "               불일치가 있으면 종료코드 1\n"\
+        "       -N N    -K 의 임의 묶음 개수 (기본: 20000, 묶음마다 파일명 1~16개)\n"\
+        "       -M      계산 구현별 처리량 (Mcells/s), 패턴 길이 x 파일명 길이별\n"\
+        "\n"
+    ;
+
+    fprintf(stdout, "%s", usage);
+}
+
+int main(int argc, char* argv[])
+{
+    bench_opt_t opt;
+    memset(&opt, 0x00, sizeof(opt));
+    opt.files = 100000;
+    opt.depth = 8;
+    opt.fanout = 8;
+    opt.seed = 1;
+    opt.reps = 5;
+    opt.rows = VISIBLE_ROWS;
+
+    int c;
+    while( (c = getopt(argc, argv, "hn:d:f:S:t:kr:l:i:s:R:v:j:KN:M")) != -1)
+    {
+        switch(c)
+        {
+            case 'n': opt.files = atoi(optarg); break;
+            case 'd': opt.depth = atoi(optarg); break;
+            case 'f': opt.fanout = atoi(optarg); break;
+            case 'S': opt.seed = strtoul(optarg, NULL, 10); break;
+            case 't': opt.tree_dir = optarg; break;
+            case 'k': opt.keep = 1; break;
+            case 'r': opt.root = optarg; break;
+            case 'l': opt.list = optarg; break;
+            case 'i': opt.map = optarg; break;
+            case 's':
+                if(opt.script_cnt < MAX_SCRIPTS)
+                    opt.scripts[opt.script_cnt++] = optarg;
+                break;
+            case 'R': opt.reps = atoi(optarg); break;
+            case 'v': opt.rows = atoi(optarg); break;
+            case 'j': fz_set_thread_count(atoi(optarg)); break;
+            case 'K': if(opt.check == 0) opt.check = 20000; break;
+            case 'N': opt.check = atoi(optarg); break;
+            case 'M': opt.micro = 1; break;
+            default:
+                show_usage();
+                exit(1);
+        }
+    }
+    if(opt.files <= 0 || opt.depth <= 0 || opt.fanout <= 0 || opt.reps <= 0 || opt.rows <= 0)
+    {
+        show_usage();
+        exit(1);
+    }
+
+    /* 계산 구현 검사/처리량 */
+    if(opt.check > 0 || opt.micro)
+    {
+        int ret = 0;
+        if(opt.check > 0)
+            ret = run_check(opt.seed, opt.check);
+        if(opt.micro && ret == 0)
+            ret = run_micro(opt.seed);
+        return ret;
+    }
+
+    fz_set_stats(1);
+    if(opt.script_cnt == 0)
+    {
+        for(int i=0; i < DEFAULT_SCRIPT_CNT; i++)
+            opt.scripts[opt.script_cnt++] = (char*) g_default_scripts[i];
+    }
+
+    /* 1. 색인 */
+    fscore_list_t list;
+    char tmpdir[PATH_MAX] = "";
+    double t0, elapsed;
+    char* what;
+
+    if(opt.list != NULL || opt.map != NULL)
+    {
+        char* path = opt.list ? opt.list : opt.map;
+        t0 = bench_ms();
+        int ok = opt.list ? load_list_file(&list, path) : fz_map_list_file(&list, path);
+        elapsed = bench_ms() - t0;
+        if(!ok)
+        {
+            fprintf(stderr, "fz_bench: %s: %s\n", path, strerror(errno));
+            return 2;
+        }
+        printf("corpus : list %s\n", path);
+        what = opt.list ? "add_list" : "fz_map_list_file";
+    }
+    else
+    {
+        char* root = opt.root;
+        if(root == NULL)
+        {
+            /* 항상 새로 만든 하위 디렉토리에 생성 (지울 때 사용자 파일을 건드리지 않는다) */
+            char* parent = opt.tree_dir;
+            if(parent == NULL)
+                parent = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+            snprintf(tmpdir, sizeof(tmpdir), "%s/fzbench.XXXXXX", parent);
+            if(mkdtemp(tmpdir) == NULL)
+            {
+                fprintf(stderr, "fz_bench: mkdtemp %s: %s\n", tmpdir, strerror(errno));
+                return 2;
+            }
+            t0 = bench_ms();
+            int made = make_tree(&opt, tmpdir);
+            if(made < 0)
+            {
+                fprintf(stderr, "fz_bench: %s: %s\n", tmpdir, strerror(errno));
+                if(!opt.keep)
+                    remove_tree(tmpdir);
+                return 2;
+            }
+            printf("corpus : synthetic %d files, depth %d, fanout %d, seed %u (%s, %.0f ms to create)\n",
+                   made, opt.depth, opt.fanout, opt.seed, tmpdir, bench_ms() - t0);
+            root = tmpdir;
+        }
+        else
+        {
+            printf("corpus : directory %s\n", root);
+        }
+
+        t0 = bench_ms();
+        load_file_list(&list, root, 1);
+        elapsed = bench_ms() - t0;
+        what = "load_file_list";
+    }
+    printf("index  : %s %d entries in %.1f ms (%.0f entries/s), peak rss %.1f MB\n",
+           what, list.len, elapsed, elapsed > 0 ? list.len / (elapsed / 1e3) : 0.0, peak_rss_mb());
+    if(list.stats.dirs > 0)
+        printf("walk   : %llu dirs, %llu files in %.1f ms\n",
+               (unsigned long long) list.stats.dirs, (unsigned long long) list.stats.files,
+               list.stats.walk_ns / 1e6);
+
+    /* 2. 키 입력 재생 */
+    int total = 0;
+    for(int i=0; i < opt.script_cnt; i++)
+        total += strlen(opt.scripts[i]) * opt.reps;
+    bench_key_t* keys = (bench_key_t*) malloc (sizeof(bench_key_t) * (total + 1));
+    if(keys == NULL)
+        return 2;
+
+    list.cands_topk = opt.rows;
+    /* 스레드 풀 생성 등 첫 호출 비용은 빼고 측정 */
+    replay_script(&list, opt.scripts[0], 0, opt.rows, keys);
+
+    int cnt = 0;
+    for(int r=0; r < opt.reps; r++)
+        for(int i=0; i < opt.script_cnt; i++)
+            cnt += replay_script(&list, opt.scripts[i], i, opt.rows, &keys[cnt]);
+
+    printf("replay : %d scripts x %d reps, %d keys, %d visible rows, %d threads\n",
+           opt.script_cnt, opt.reps, cnt, opt.rows, fz_get_thread_count());
+    printf("  %-24s %6s %9s %9s %9s %9s %12s\n", "", "keys", "p50 ms", "p99 ms", "max ms", "mean ms", "scored/key");
+    report_keys("all", keys, cnt, -1, -1);
+    report_keys("typed", keys, cnt, -1, 0);
+    report_keys("backspace", keys, cnt, -1, 1);
+    for(int i=0; i < opt.script_cnt; i++)
+        report_keys(opt.scripts[i], keys, cnt, i, -1);
+    printf("peak rss %.1f MB\n", peak_rss_mb());
+
+    free(keys);
+    clear_file_list(&list);
+    if(tmpdir[0] != '\0' && !opt.keep)
+        remove_tree(tmpdir);
+    return 0;
+}